@@ -0,0 +1,134 @@
+#!/usr/bin/env python3
+# Builds the crypto_bench firmware per core variant, runs it under simavr and
+# compares the cycle counts against bench_baseline.json. Exits 1 if a kernel
+# got slower than the baseline by more than the tolerance, went missing, or
+# has no baseline count (also when the baseline file does not exist).
+#
+#   bench_runner.py [--no-build] [--update] [--tolerance <percent>]
+#                   [--baseline <file>] [--simavr <path>] [variant ...]
+#
+# Needs avr-gcc/avr-objcopy and simavr on the PATH, no hardware. Output lines
+# are "<variant> <kernel> <metric> <cycles> <baseline> <change%>", and the
+# last line is PASS or FAIL. --update writes the measured counts as the new
+# baseline (after an intended change, commit the file with it).
+#
+# No bench_baseline.json is committed: the counts have to come from the
+# avr-gcc and simavr that run the check. Before the first check, on the
+# machine that will run it and from an unmodified tree, run
+#
+#   ./bench_runner.py --update
+#
+# and commit bench_baseline.json. Until then every run fails.
+import sys, os, re, json, subprocess
+
+here = os.path.dirname(os.path.abspath(__file__))
+
+# make arguments per variant, see the Makefile here and core/Makefile.include
+variants = {
+   'asm':      [],
+   'c':        ['SHA256_CORE=sha256.c', 'SHA1_CORE=sha1.c'],
+}
+
+MCU = 'atmega328p'
+F_CPU = '8000000'
+# Whole run is a few million cycles, simavr takes seconds
+TIMEOUT = 120
+
+bench_line = re.compile(r'BENCH (\w+) (\w+) (\d+)')
+
+def build(variant):
+   bin_name = 'bench-' + variant
+   subprocess.run(['make', '-C', here, 'BIN=' + bin_name, 'OBJECTDIR=obj-' + variant]
+                  + variants[variant] + [bin_name + '.elf'], check=True)
+   # One contiguous image: older simavr only loads the last chunk of a hex
+   # file, and the microvisor sections sit apart from .text
+   hexfile = os.path.join(here, bin_name + '.sim.hex')
+   subprocess.run(['avr-objcopy', '-j', '.text', '-j', '.data', '-j', '.bootloader',
+                   '-j', '.bootmem', '-j', '.bootmid', '--gap-fill', '0xff', '-O', 'ihex',
+                   os.path.join(here, bin_name + '.elf'), hexfile], check=True)
+   return hexfile
+
+# Returns {'<kernel> <metric>': cycles} for one firmware image
+def run(simavr, hexfile):
+   p = subprocess.run([simavr, '-m', MCU, '-f', F_CPU, hexfile], stdout=subprocess.PIPE,
+                      stderr=subprocess.STDOUT, timeout=TIMEOUT)
+   # simavr prints UART lines with colour codes and control characters as '.'
+   out = re.sub(r'\x1b\[[0-9;]*m', '', p.stdout.decode(errors='replace'))
+   results = {}
+   done = False
+   for line in out.splitlines():
+      m = bench_line.search(line)
+      if m:
+         results[m.group(1) + ' ' + m.group(2)] = int(m.group(3))
+      elif 'BENCH done' in line:
+         done = True
+   if not done:
+      print(out)
+      print("ERROR: firmware did not finish:", hexfile)
+      sys.exit(2)
+   return results
+
+def main(argv):
+   build_fw = '--no-build' not in argv
+   update = '--update' in argv
+   argv = [a for a in argv if a not in ('--no-build', '--update')]
+   opts = {'--tolerance': '1', '--baseline': os.path.join(here, 'bench_baseline.json'),
+           '--simavr': 'simavr'}
+   for o in opts:
+      if o in argv:
+         i = argv.index(o)
+         if i + 1 >= len(argv):
+            print('ERROR: missing value for', o)
+            sys.exit(2)
+         opts[o] = argv[i+1]
+         del argv[i:i+2]
+   tolerance = float(opts['--tolerance'])
+   names = argv or list(variants)
+   for v in names:
+      if v not in variants:
+         print('bench_runner.py [--no-build] [--update] [--tolerance <percent>] [--baseline <file>] [--simavr <path>] [' + '|'.join(variants) + ' ...]')
+         sys.exit(2)
+
+   baseline = {}
+   if os.path.isfile(opts['--baseline']):
+      with open(opts['--baseline']) as f:
+         baseline = json.load(f)
+   elif not update:
+      print('ERROR: no baseline:', opts['--baseline'])
+      print('Record it first: ./bench_runner.py --update on an unmodified tree, then commit the file')
+      print('FAIL')
+      sys.exit(1)
+
+   measured = {}
+   failed = False
+   for v in names:
+      hexfile = build(v) if build_fw else os.path.join(here, 'bench-' + v + '.sim.hex')
+      measured[v] = run(opts['--simavr'], hexfile)
+      ref = baseline.get(v, {})
+      for k in sorted(set(measured[v]) | set(ref)):
+         cycles = measured[v].get(k)
+         if cycles is None:
+            print(v, k, 'missing', ref[k], '-')
+            failed = True
+         elif k not in ref:
+            # Nothing to compare with: only --update takes it
+            print(v, k, cycles, 'new', '-')
+            failed = True
+         else:
+            change = 100.0 * (cycles - ref[k]) / ref[k]
+            print(v, k, cycles, ref[k], '%+.2f%%' % change)
+            if change > tolerance:
+               failed = True
+
+   if update:
+      baseline.update(measured)
+      with open(opts['--baseline'], 'w') as f:
+         json.dump(baseline, f, indent=1, sort_keys=True)
+         f.write('\n')
+      print('Baseline written:', opts['--baseline'])
+
+   print('FAIL' if failed and not update else 'PASS')
+   sys.exit(1 if failed and not update else 0)
+
+if __name__ == '__main__':
+   main(sys.argv[1:])
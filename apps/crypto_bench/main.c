@@ -0,0 +1,158 @@
+#include <avr/pgmspace.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BAUD 9600
+#include <util/setbaud.h>
+
+#include "microvisor.h"
+#include "sha256.h"
+#include "hmac-sha256.h"
+#include "sha1.h"
+#include "hmac-sha1.h"
+#include "blake2s.h"
+#include "serial.h"
+
+/*
+ * Cycle counts of the core/crypto kernels, one UART line per measurement:
+ *   BENCH <kernel> <metric> <cycles>
+ * metric is block (one 64 byte block from RAM), page / page_P (PAGE_SIZE
+ * bytes from RAM / flash, as the microvisor hashes images), last (lastBlock
+ * with no bytes left, i.e. the padding block; one flagged block for BLAKE2s),
+ * init / final (MAC key setup and tag computation). The run ends with
+ * "BENCH done" and the CPU sleeps with interrupts off, which also ends a
+ * simavr run. See bench_runner.py.
+ *
+ * Timer1 runs at the CPU clock and is stopped before it is read. The call
+ * overhead of the start/stop pair is subtracted; the overflow interrupt
+ * (every 65536 cycles) is counted along, well below 0.1%.
+ */
+
+static const uint8_t key[32] = {
+  0x6e, 0x26, 0x88, 0x6e, 0x4e, 0x07, 0x07, 0xe1, 0xb3, 0x0f, 0x24, 0x16,
+  0x0e, 0x99, 0xb9, 0x12, 0xe4, 0x61, 0xc4, 0x24, 0x01, 0x01, 0x01, 0x01,
+  0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01 };
+
+/* Contents do not change the timing, only where they are read from */
+static const uint8_t page_P[PAGE_SIZE] PROGMEM = { 0xA5 };
+static uint8_t page[PAGE_SIZE];
+static uint8_t digest[32];
+
+static sha256_ctx_t sha256_ctx;
+static hmac_sha256_ctx_t hmac_sha256_ctx;
+static sha1_ctx_t sha1_ctx;
+static hmac_sha1_ctx_t hmac_sha1_ctx;
+static blake2s_ctx_t blake2s_ctx;
+
+static volatile uint16_t timer1_overflows;
+static uint32_t overhead;
+
+ISR(TIMER1_OVF_vect) {
+  timer1_overflows++;
+}
+
+static void __attribute__((noinline)) bench_start(void) {
+  cli();
+  TCNT1 = 0;
+  TIFR1 = _BV(TOV1);
+  timer1_overflows = 0;
+  sei();
+  TCCR1B = _BV(CS10);
+}
+
+static uint32_t __attribute__((noinline)) bench_stop(void) {
+  uint16_t t;
+
+  TCCR1B = 0;
+  cli();
+  t = TCNT1;
+  // Overflow not serviced before the timer stopped
+  if (TIFR1 & _BV(TOV1)) {
+    TIFR1 = _BV(TOV1);
+    timer1_overflows++;
+  }
+  sei();
+  return ((uint32_t)timer1_overflows << 16) | t;
+}
+
+static void report(const char *kernel, const char *metric, uint32_t cycles) {
+  char buffer[11];
+
+  uart_puts("BENCH ");
+  uart_puts((char *)kernel);
+  uart_putchar(' ');
+  uart_puts((char *)metric);
+  uart_putchar(' ');
+  ultoa(cycles - overhead, buffer, 10);
+  uart_puts(buffer);
+  uart_putchar('\n');
+}
+
+#define BENCH(kernel, metric, call) do { \
+    bench_start();                       \
+    call;                                \
+    report(kernel, metric, bench_stop()); \
+  } while (0)
+
+static void bench_sha256(void) {
+  sha256_init(&sha256_ctx);
+  BENCH("sha256", "block", sha256_nextBlock(&sha256_ctx, page));
+  BENCH("sha256", "page", sha256_nextBlocks(&sha256_ctx, page, PAGE_SIZE / SHA256_BLOCK_BYTES));
+  BENCH("sha256", "page_P", sha256_nextBlocks_P(&sha256_ctx, page_P, PAGE_SIZE / SHA256_BLOCK_BYTES));
+  BENCH("sha256", "last", sha256_lastBlock(&sha256_ctx, page, 0));
+
+  BENCH("hmac_sha256", "init", hmac_sha256_init(&hmac_sha256_ctx, key, 256));
+  hmac_sha256_nextBlocks(&hmac_sha256_ctx, page, PAGE_SIZE / HMAC_SHA256_BLOCK_BYTES);
+  hmac_sha256_lastBlock(&hmac_sha256_ctx, page, 0);
+  BENCH("hmac_sha256", "final", hmac_sha256_final(digest, &hmac_sha256_ctx));
+}
+
+static void bench_sha1(void) {
+  sha1_init(&sha1_ctx);
+  BENCH("sha1", "block", sha1_nextBlock(&sha1_ctx, page));
+  BENCH("sha1", "last", sha1_lastBlock(&sha1_ctx, page, 0));
+
+  BENCH("hmac_sha1", "init", hmac_sha1_init(&hmac_sha1_ctx, key, 256));
+  BENCH("hmac_sha1", "page", hmac_sha1_nextBlocks(&hmac_sha1_ctx, page, PAGE_SIZE / HMAC_SHA1_BLOCK_BYTES));
+  BENCH("hmac_sha1", "page_P", hmac_sha1_nextBlocks_P(&hmac_sha1_ctx, page_P, PAGE_SIZE / HMAC_SHA1_BLOCK_BYTES));
+  hmac_sha1_lastBlock(&hmac_sha1_ctx, page, 0);
+  BENCH("hmac_sha1", "final", hmac_sha1_final(digest, &hmac_sha1_ctx));
+}
+
+static void bench_blake2s(void) {
+  BENCH("blake2s", "init", blake2s_init(&blake2s_ctx, key, 256));
+  BENCH("blake2s", "block", blake2s_nextBlock(&blake2s_ctx, page));
+  BENCH("blake2s", "page", blake2s_nextBlocks(&blake2s_ctx, page, PAGE_SIZE / BLAKE2S_BLOCK_BYTES));
+  BENCH("blake2s", "page_P", blake2s_nextBlocks_P(&blake2s_ctx, page_P, PAGE_SIZE / BLAKE2S_BLOCK_BYTES));
+  // Keyed BLAKE2s has no separate final, the last block is flagged
+  BENCH("blake2s", "last", blake2s_lastBlock(&blake2s_ctx, page, BLAKE2S_BLOCK_BITS));
+}
+
+int main(void) {
+  uart_init();
+
+  memset(page, 0x5A, sizeof(page));
+  TCCR1A = 0;
+  TCCR1B = 0;
+  TIMSK1 = _BV(TOIE1);
+
+  bench_start();
+  overhead = bench_stop();
+
+  bench_sha256();
+  bench_sha1();
+  bench_blake2s();
+  uart_puts("BENCH done\n");
+
+  // Let the last byte leave the UART, then stop for good
+  loop_until_bit_is_set(UCSR0A, UDRE0);
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  cli();
+  sleep_enable();
+  sleep_cpu();
+  while(1);
+}
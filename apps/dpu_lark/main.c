@@ -8,6 +8,7 @@
 #include <util/setbaud.h>
 
 #include "microvisor.h"
+#include "sha256.h"
 #include "serial.h"
 
 #define LOC_HASH_MAP_SIZE 32
@@ -173,9 +174,9 @@ int main(void) {
 
   uint8_t metadata[LOC_HASH_MAP_SIZE] = {0};
   uint16_t prover_id_map[LOC_HASH_MAP_SIZE] = {0};
-  uint8_t prev_mem_state[32] = {0};
 
   map_init(prover_id_map);
+  att_init();
   uart_init();
   uart_puts("Starting experiments for prover count: ");
   print_uint32(LOC_HASH_MAP_SIZE);
@@ -202,6 +203,9 @@ int main(void) {
   uint64_t status_update_kwrd = 0x2222222222222222;
   uint64_t status_valid_kwrd = 0x3333333333333333;
   uint64_t status_final_kwrd = 0x4444444444444444;
+  uint64_t att_sample_kwrd = 0x7777777777777777;
+  uint64_t att_epoch_kwrd = 0x8888888888888888;
+  uint64_t att_collect_kwrd = 0xAAAAAAAAAAAAAAAA;
 
   uint8_t valid_list_array_length = LOC_HASH_MAP_SIZE / 64;
   uint64_t valid_list[valid_list_array_length];
@@ -228,7 +232,7 @@ int main(void) {
   // sei();
   // start_time = read_timer1();
 
-  // retval = parse_att_msg(ver_msg_buff, 22, NULL, 1, metadata, prev_mem_state);
+  // retval = parse_att_msg(ver_msg_buff, 22, NULL, metadata);
 
   // cli();
   // end_time = read_timer1();
@@ -254,7 +258,7 @@ int main(void) {
   // sei();
   // start_time = read_timer1();
 
-  // retval = parse_att_msg(ver_msg_buff, msg_length, NULL, 1, metadata, prev_mem_state);
+  // retval = parse_att_msg(ver_msg_buff, msg_length, NULL, metadata);
 
   // cli();
   // end_time = read_timer1();
@@ -280,7 +284,7 @@ int main(void) {
   // sei();
   // start_time = read_timer1();
 
-  // retval = parse_att_msg(ver_msg_buff, msg_length, NULL, 1, metadata, prev_mem_state);
+  // retval = parse_att_msg(ver_msg_buff, msg_length, NULL, metadata);
 
   // cli();
   // end_time = read_timer1();
@@ -307,7 +311,7 @@ int main(void) {
   sei();
   start_time = read_timer1();
 
-  retval = parse_att_msg(ver_msg_buff, msg_length, prv_msg_buff, 1, metadata, prev_mem_state);
+  retval = parse_att_msg(ver_msg_buff, msg_length, prv_msg_buff, metadata);
 
   cli();
   end_time = read_timer1();
@@ -319,7 +323,7 @@ int main(void) {
   print_uint32(elapsed_time);
   uart_puts("return value: ");
   uart_print_int8(retval);
-  print_buffer_hex(prv_msg_buff, 106);
+  print_buffer_hex(prv_msg_buff, ATT_RESP_SIZE);
   uart_puts("-------------------------------------\n");
 
 
@@ -336,7 +340,7 @@ int main(void) {
   // sei();
   // start_time = read_timer1();
 
-  // retval = parse_att_msg(ver_msg_buff, msg_length, prv_msg_buff, 0, metadata, prev_mem_state);
+  // retval = parse_att_msg(ver_msg_buff, msg_length, prv_msg_buff, metadata);
 
   // cli();
   // end_time = read_timer1();
@@ -351,9 +355,192 @@ int main(void) {
   // print_buffer_hex(prv_msg_buff, 106);
   // uart_puts("-------------------------------------\n");
 
+/*_____________________Att_sample____________________________*/
+  // memcpy(ver_msg_buff + 14, &att_sample_kwrd, 8);
+  // memcpy(ver_msg_buff + 22, &ctr, 2);
+  // memcpy(ver_msg_buff + 24, nonce, 16);
+  // ver_msg_buff[40] = 16; // k pages
+  // msg_length = 41;
+  // uart_puts("Starting att_sample trial\n");
+  // cli();
+  // timer1_overflows = 0;
+  // timer1_init2();
+  // sei();
+  // start_time = read_timer1();
+
+  // retval = parse_att_msg(ver_msg_buff, msg_length, prv_msg_buff, metadata);
+
+  // cli();
+  // end_time = read_timer1();
+  // elapsed_timer_over = timer1_overflows;
+  // sei();
+
+  // elapsed_time = calculate_microseconds(start_time, end_time, elapsed_timer_over, 8);
+  // uart_puts("Finished trial. Time: ");
+  // print_uint32(elapsed_time);
+  // uart_puts("return value: ");
+  // uart_print_int8(retval);
+  // print_buffer_hex(prv_msg_buff, ATT_SAMPLE_RESP_SIZE);
+  // uart_puts("-------------------------------------\n");
+
+/*_____________________Att_self____________________________*/
+  // Epoch broadcast once, then responses are made while idle and sent as is
+  // memcpy(ver_msg_buff + 14, &att_epoch_kwrd, 8);
+  // memcpy(ver_msg_buff + 24, nonce, 16);
+  // memcpy(ver_msg_buff + ATT_EPOCH_MAC_OFFSET, epoch_mac, MAC_BYTES);  // verifier MAC over [14:40]
+  // parse_att_msg(ver_msg_buff, ATT_EPOCH_MSG_SIZE, NULL, metadata);
+  // uart_puts("Starting att_self trial\n");
+  // cli();
+  // timer1_overflows = 0;
+  // timer1_init2();
+  // sei();
+  // start_time = read_timer1();
+
+  // retval = att_self(prv_msg_buff);
+
+  // cli();
+  // end_time = read_timer1();
+  // elapsed_timer_over = timer1_overflows;
+  // sei();
+
+  // elapsed_time = calculate_microseconds(start_time, end_time, elapsed_timer_over, 8);
+  // uart_puts("Finished trial. Time: ");
+  // print_uint32(elapsed_time);
+  // uart_puts("return value: ");
+  // uart_print_int8(retval);
+  // print_buffer_hex(prv_msg_buff, ATT_SELF_RESP_SIZE);
+  // uart_puts("-------------------------------------\n");
+
+/*_____________________Att_measure____________________________*/
+  // Self-measurement on the Timer1 overflow count (prescaler 8: one overflow
+  // every 65.5 ms), then a single att_collect fetches the history
+  // uint8_t history_buff[ATT_HISTORY_RESP_SIZE];
+  // uint32_t next_measure = 0;
+  // cli();
+  // timer1_overflows = 0;
+  // timer1_init2();
+  // sei();
+  // for(uint8_t i = 0; i < ATT_HISTORY; ) {
+  //   cli();
+  //   elapsed_timer_over = timer1_overflows;
+  //   sei();
+  //   if(elapsed_timer_over >= next_measure) {
+  //     i += att_measure(elapsed_timer_over);
+  //     next_measure = elapsed_timer_over + 16;
+  //   }
+  // }
+  // memcpy(ver_msg_buff + 14, &att_collect_kwrd, 8);
+  // memcpy(ver_msg_buff + 22, &ctr, 2);
+  // memcpy(ver_msg_buff + 24, nonce, 16);
+  // retval = parse_att_msg(ver_msg_buff, 40, history_buff, metadata);
+  // uart_puts("return value: ");
+  // uart_print_int8(retval);
+  // print_buffer_hex(history_buff, ATT_HISTORY_RESP_SIZE);
+  // uart_puts("-------------------------------------\n");
+
+/*_____________________Att_resp_batch____________________________*/
+  // Four requests answered with one memory scan, responses back to back
+  // uint8_t batch_reqs[4 * ATT_BATCH_REQ_SIZE];
+  // uint8_t batch_resps[4 * ATT_RESP_SIZE];
+  // for(uint8_t i = 0; i < 4; i++) {
+  //   memcpy(batch_reqs + i * ATT_BATCH_REQ_SIZE, &ctr, 2);
+  //   memcpy(batch_reqs + i * ATT_BATCH_REQ_SIZE + 2, nonce, 16);
+  //   batch_reqs[i * ATT_BATCH_REQ_SIZE + 2] ^= i;
+  // }
+  // uart_puts("Starting att_resp_batch trial\n");
+  // cli();
+  // timer1_overflows = 0;
+  // timer1_init2();
+  // sei();
+  // start_time = read_timer1();
+
+  // att_resp_batch(batch_reqs, 4, batch_resps, metadata);
+
+  // cli();
+  // end_time = read_timer1();
+  // elapsed_timer_over = timer1_overflows;
+  // sei();
+
+  // elapsed_time = calculate_microseconds(start_time, end_time, elapsed_timer_over, 8);
+  // uart_puts("Finished trial. Time: ");
+  // print_uint32(elapsed_time);
+  // print_buffer_hex(batch_resps, 4 * ATT_RESP_SIZE);
+  // uart_puts("-------------------------------------\n");
+
+/*_____________________sha256_page____________________________*/
+  // One 256 byte page: four sha256_nextBlock calls, then one sha256_nextBlocks
+  // uint8_t page_buff[256] = {0};
+  // sha256_ctx_t sha_ctx;
+  // sha256_init(&sha_ctx);
+  // uart_puts("Starting sha256_nextBlock x4 trial\n");
+  // cli();
+  // timer1_overflows = 0;
+  // timer1_init2();
+  // sei();
+  // start_time = read_timer1();
+
+  // for(uint8_t i = 0; i < 4; i++)
+  //   sha256_nextBlock(&sha_ctx, page_buff + 64*i);
+
+  // cli();
+  // end_time = read_timer1();
+  // elapsed_timer_over = timer1_overflows;
+  // sei();
+  // elapsed_time = calculate_microseconds(start_time, end_time, elapsed_timer_over, 8);
+  // uart_puts("Finished trial. Time: ");
+  // print_uint32(elapsed_time);
+
+  // uart_puts("Starting sha256_nextBlocks trial\n");
+  // cli();
+  // timer1_overflows = 0;
+  // timer1_init2();
+  // sei();
+  // start_time = read_timer1();
+
+  // sha256_nextBlocks(&sha_ctx, page_buff, 4);
+
+  // cli();
+  // end_time = read_timer1();
+  // elapsed_timer_over = timer1_overflows;
+  // sei();
+  // elapsed_time = calculate_microseconds(start_time, end_time, elapsed_timer_over, 8);
+  // uart_puts("Finished trial. Time: ");
+  // print_uint32(elapsed_time);
+  // uart_puts("-------------------------------------\n");
+
+/*_____________________Att_sliced____________________________*/
+  // Full flash MAC in one block slices, UART stays serviceable in between.
+  // Longest slice is what a relayed byte has to wait for at most.
+  // uint8_t att_mac[MAC_BYTES];
+  // uint32_t longest_slice = 0;
+  // uart_puts("Starting att_sliced trial\n");
+  // att_start((uint8_t*) nonce);
+  // do {
+  //   cli();
+  //   timer1_overflows = 0;
+  //   timer1_init2();
+  //   sei();
+  //   start_time = read_timer1();
+
+  //   retval = att_step(1);
+
+  //   cli();
+  //   end_time = read_timer1();
+  //   elapsed_timer_over = timer1_overflows;
+  //   sei();
+  //   elapsed_time = calculate_microseconds(start_time, end_time, elapsed_timer_over, 8);
+  //   if(elapsed_time > longest_slice)
+  //     longest_slice = elapsed_time;
+  // } while(retval);
+  // att_finish(att_mac);
+  // uart_puts("Finished trial. Longest slice: ");
+  // print_uint32(longest_slice);
+  // print_buffer_hex(att_mac, MAC_BYTES);
+  // uart_puts("-------------------------------------\n");
+
   /*__________________device_auth____________________________*/
   // memcpy(ver_msg_buff + 14, &status_valid_kwrd, 8);
-  // parse_att_msg(ver_msg_buff, msg_length, prv_msg_buff, 0, metadata, prev_mem_state);
+  // parse_att_msg(ver_msg_buff, msg_length, prv_msg_buff, metadata);
   // uint8_t remote_mac[] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
   // uart_puts("Starting device_auth trial\n");
   // cli();
@@ -380,7 +567,7 @@ int main(void) {
 
   /*__________________device_auth_valid____________________________*/
   // memcpy(ver_msg_buff + 14, &status_valid_kwrd, 8);
-  // parse_att_msg(ver_msg_buff, msg_length, prv_msg_buff, 0, metadata, prev_mem_state);
+  // parse_att_msg(ver_msg_buff, msg_length, prv_msg_buff, metadata);
 
   // uart_puts("Starting device_auth_valid trial\n");
   // cli();
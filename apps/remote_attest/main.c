@@ -8,7 +8,7 @@
 
 int main(void) {
 
-  uint8_t buf[20];
+  uint8_t buf[MAC_BYTES > 20 ? MAC_BYTES : 20]; // nonce in, MAC out
   uint16_t i;
 
   uart_init();
@@ -24,7 +24,7 @@ int main(void) {
     remote_attestation(buf);
 
     // Send attestation reponse to verifier over serial!
-    for(i=0; i<20; i++) {
+    for(i=0; i<MAC_BYTES; i++) {
       uart_putchar(buf[i]);
     }
   }
@@ -1,16 +1,20 @@
 #!/usr/bin/env python3
 import sys, os, binascii
-import hmac, hashlib, time
+import time
 sys.path += [ os.path.join(os.path.split(__file__)[0], 'libs') ]
+sys.path += [ os.path.join(os.path.split(__file__)[0], '../../core/scripts') ]
 import serial
 from intelhex import IntelHex
-
-# 160 bit key
-key = b'\x6e\x26\x88\x6e\x4e\x07\x07\xe1\xb3\x0f\x24\x16\x0e\x99\xb9\x12\xe4\x61\xc4\x24'
+import mac_engine, att_digest
 
 def main(argv):
+   # Same attestation options as the build, see core/Makefile.include
+   skip_erased = '--skip-erased' in argv
+   boot_first = '--boot-first' in argv
+   argv = [a for a in argv if a not in ('--skip-erased', '--boot-first')]
+   mac = mac_engine.parse_arg(argv)
    if len(argv) != 2:
-      print('challenger.py <hexfile> <serialport>')
+      print('verifier.py [--skip-erased] [--boot-first] [--mac sha256|sha1|blake2s] <hexfile> <serialport>')
       sys.exit(2)
 
    # Check if hexfile exists
@@ -38,14 +42,12 @@ def main(argv):
    print(answer)
 
    #Calc digest
-   hmac_gen = hmac.new(key, None, hashlib.sha1)
-   hmac_gen.update(ih.tobinstr(0,32*1024-1)) #32*1024-1
-   hmac_gen.update(nonce)
+   flash = ih.tobinarray(0, 32*1024-1).tobytes()
    print("Expected response:");
-   print(binascii.hexlify(hmac_gen.digest()))
+   print(binascii.hexlify(att_digest.full_mac(flash, nonce, skip_erased, boot_first, mac)))
 
    # Get digest from mote
-   mote_digest = ser.read(20)
+   mote_digest = ser.read(mac_engine.tag_bytes(mac))
    print("Prover response:");
    print(binascii.hexlify(mote_digest))
 
@@ -0,0 +1,283 @@
+#!/usr/bin/env python3
+# Runs serial_loader.py's transfer against a model of the secure_loading
+# device on a pty, no hardware needed:
+#
+#   loader_selftest.py [--pages <n>] [--loss <probability>] [--latency <ms>]
+#
+# The model takes the host's bytes at 9600 baud (10 bits per byte), keeps
+# receiving while it programs flash (load_rx()), spends SPM_MS per written
+# page and HASH_MS per page on the deferred scan and MAC at the end, and
+# checks every page against the image. --loss corrupts received bytes at
+# random, --latency (default 4 ms) delays each answer as a USB-serial bridge
+# does (FTDI parts wait up to 16 ms by default). One run resumes a transfer
+# that stopped halfway, with the pages before it still in flash. Page list
+# images (ota_pages.py) cost EE_MS per list byte and CHECK_MS per page; the
+# last run sends one with a corrupted page, which the device refuses as it
+# arrives. It compares against the unframed stop-and-wait protocol of the
+# previous loader, whose device scans and MACs each page before answering.
+# Prints the time per mode and exits 1 if a transfer failed.
+import sys, os, time, random, threading, collections, tty, binascii
+sys.path += [ os.path.join(os.path.split(__file__)[0], 'libs') ]
+sys.path += [ os.path.join(os.path.split(__file__)[0], '../../core/scripts') ]
+import serial
+import serial_loader
+import ota_pages
+
+BAUD = 9600
+BYTE_TIME = 10.0 / BAUD
+# Page erase + write, and scan + HMAC-SHA256 (asm core) of one page at 8 MHz
+SPM_MS = 8.5
+HASH_MS = 27.0
+# SHA-256 page check against the list, EEPROM write of one list byte
+CHECK_MS = 22.0
+EE_MS = 3.4
+PAGE_SIZE = serial_loader.PAGE_SIZE
+
+# Host -> device line: delivers bytes at the baud rate, drops or flips some
+class Line(threading.Thread):
+   def __init__(self, fd, loss):
+      threading.Thread.__init__(self, daemon=True)
+      self.fd = fd
+      self.loss = loss
+      self.rx = collections.deque()
+      self.cond = threading.Condition()
+   def run(self):
+      due = time.time()
+      while True:
+         try:
+            data = os.read(self.fd, 4096)
+         except OSError:
+            return
+         due = max(due, time.time())
+         for c in data:
+            due += BYTE_TIME
+            time.sleep(max(0, due - time.time()))
+            if random.random() < self.loss:
+               c ^= 0x5A
+            with self.cond:
+               self.rx.append(c)
+               self.cond.notify()
+   # Next byte, None after timeout seconds without one
+   def get(self, timeout):
+      with self.cond:
+         if not self.rx and not self.cond.wait_for(lambda: self.rx, timeout):
+            return None
+         return self.rx.popleft()
+
+class Device(threading.Thread):
+   def __init__(self, fd, line, latency, framed, flash):
+      threading.Thread.__init__(self, daemon=True)
+      self.fd = fd
+      self.line = line
+      self.latency = latency
+      self.framed = framed
+      # Pages in SHADOW, all recorded for the image sent (load_progress())
+      self.flash = flash
+      self.done = threading.Event()
+      self.tx = collections.deque()
+      self.tx_cond = threading.Condition()
+      threading.Thread(target=self.tx_run, daemon=True).start()
+   # UART out plus the USB-serial bridge, in order
+   def reply(self, data):
+      with self.tx_cond:
+         self.tx.append((time.time() + len(data)*BYTE_TIME + self.latency, data))
+         self.tx_cond.notify()
+   def tx_run(self):
+      while True:
+         with self.tx_cond:
+            self.tx_cond.wait_for(lambda: self.tx)
+            due, data = self.tx.popleft()
+         time.sleep(max(0, due - time.time()))
+         os.write(self.fd, data)
+   def run(self):
+      (self.framed_run if self.framed else self.legacy_run)()
+   # Pages in order of the image, after a header frame/stream
+   def pages_of(self, header):
+      total = header[0] | header[1] << 8
+      return total, (total + PAGE_SIZE - 1)//PAGE_SIZE
+
+   def legacy_run(self):
+      get = lambda: self.line.get(None)
+      mode = get()
+      header = bytes(get() for _ in range(6))
+      header += bytes(get() for _ in range(2*(header[4] | header[5] << 8) + 32))
+      total, pages = self.pages_of(header)
+      self.reply(b'o')
+      for j in range(pages):
+         self.flash[j] = bytes(get() for _ in range(min(PAGE_SIZE, total - j*PAGE_SIZE)))
+         time.sleep((SPM_MS + HASH_MS) / 1000)
+         self.reply(b'o')
+      self.reply(b'd')
+      self.done.set()
+
+   def ack(self, seq):
+      if seq:
+         return b'A' + bytes((seq & 0xFF,))
+      landed = bytearray(serial_loader.PROGRESS_SIZE)
+      for j in self.flash:
+         landed[j >> 3] |= 1 << (j & 0x07)
+      return b'A\x00R' + bytes(landed)
+
+   # Same frame parser and replies as main.c, without delta and LZ
+   def frame(self):
+      c = self.line.get(None)
+      while c != serial_loader.FRAME_SOF:
+         c = self.line.get(None)
+      body = bytearray()
+      for n in (3, None, 2):
+         if n is None:
+            n = body[1] | body[2] << 8
+            if n > PAGE_SIZE + 64:
+               return None
+         for _ in range(n):
+            c = self.line.get(0.02)
+            if c is None:
+               return None
+            body.append(c)
+      if binascii.crc_hqx(bytes(body[:-2]), 0) != (body[-2] | body[-1] << 8):
+         return None
+      return body[0], bytes(body[3:-2])
+
+   def framed_run(self):
+      expect = 0
+      nak = False
+      missing = None
+      parts = 0
+      while missing is None or expect <= parts + len(missing):
+         f = self.frame()
+         if f is None or f[0] != expect & 0xFF:
+            if f is not None and f[0] == (expect - 1) & 0xFF:
+               self.reply(self.ack(f[0]))
+            elif not nak:
+               self.reply(b'N' + bytes((expect & 0xFF,)))
+               nak = True
+            continue
+         nak = False
+         if expect == 0:
+            total, pages = self.pages_of(f[1][1:])
+            missing = [j for j in range(pages) if j not in self.flash]
+            if f[1][:1] == b'P':
+               parts = -(-(pages*ota_pages.PAGE_HASH_BYTES + 32) // PAGE_SIZE)
+            hashes = b''
+         elif expect <= parts:
+            hashes += f[1]
+            time.sleep(len(f[1]) * EE_MS / 1000)
+         else:
+            j = missing[expect - 1 - parts]
+            if parts:
+               time.sleep(CHECK_MS / 1000)
+               page = f[1] + b'\xff'*(PAGE_SIZE - len(f[1]))
+               if ota_pages.page_hash(page, j*PAGE_SIZE) != hashes[8*j:8*j+8]:
+                  self.reply(b'r')
+                  self.done.set()
+                  return
+            self.flash[j] = f[1]
+         time.sleep(SPM_MS / 1000)
+         self.reply(self.ack(expect))
+         expect += 1
+      self.reply(b'd')
+      # Deferred scan and MAC in verify_activate_image()
+      time.sleep(pages * HASH_MS / 1000)
+      self.done.set()
+
+def legacy_transfer(ser, payloads):
+   ser.timeout = serial_loader.TIMEOUT
+   ser.write(payloads[0])
+   for p in payloads[1:]:
+      if ser.read() != b'o':
+         raise serial_loader.LoadError('no answer from the device')
+      ser.write(p)
+   ser.read()
+   return 0
+
+# Returns (seconds until activation, frames resent), or None if it failed.
+# flash holds the pages the device has already. An image with a page list
+# (listed) is expected to be refused if bad.
+def run(image, window, loss, latency, flash, listed=False, bad=False):
+   master, slave = os.openpty()
+   tty.setraw(master)
+   tty.setraw(slave)
+   line = Line(master, loss)
+   device = Device(master, line, latency, window is not None, flash)
+   line.start()
+   device.start()
+   ser = serial.Serial(os.ttyname(slave), BAUD)
+   payloads, sent = serial_loader.payloads(image, False, False, 'sha256', listed)
+   start = time.time()
+   try:
+      if window is None:
+         resent = legacy_transfer(ser, payloads)
+      else:
+         resent = serial_loader.load(ser, payloads, sent, window, log=lambda *a: None)[0]
+         if ser.read() != b'd':
+            raise serial_loader.LoadError('no done')
+      device.done.wait(60)
+      elapsed = time.time() - start
+   except serial_loader.LoadError as e:
+      if bad and 'refused' in str(e):
+         return time.time() - start, 0
+      print('ERROR:', e)
+      return None
+   finally:
+      ser.close()
+      os.close(slave)
+   if bad:
+      print('ERROR: bad page taken')
+      return None
+   data = image[len(payloads[0]) - 1 + sum(len(p) for p, i in zip(payloads[1:], sent) if i is None):]
+   for j in range(len(sent) - sent.count(None)):
+      if device.flash.get(j) != data[j*PAGE_SIZE:(j+1)*PAGE_SIZE]:
+         print('ERROR: page', j, 'differs')
+         return None
+   return elapsed, resent
+
+def main(argv):
+   opts = {'--pages': '16', '--loss': '0', '--latency': '4'}
+   for o in opts:
+      if o in argv:
+         i = argv.index(o)
+         if i + 1 >= len(argv):
+            print('loader_selftest.py [--pages <n>] [--loss <probability>] [--latency <ms>]')
+            sys.exit(2)
+         opts[o] = argv[i+1]
+         del argv[i:i+2]
+   if argv:
+      print('loader_selftest.py [--pages <n>] [--loss <probability>] [--latency <ms>]')
+      sys.exit(2)
+   pages = int(opts['--pages'])
+   loss = float(opts['--loss'])
+   latency = float(opts['--latency']) / 1000
+
+   # Header (size, data start, no 2nd words, MAC) and a last page that is short
+   rng = random.Random(1)
+   total = pages*PAGE_SIZE - 100
+   image = total.to_bytes(2, 'little') + total.to_bytes(2, 'little') + bytes(2)
+   image += bytes(rng.randrange(256) for _ in range(32 + total))
+
+   # Same image with a page list, and with page 2 corrupted after the list
+   # was made
+   listed = image[:38] + ota_pages.page_list(image[38:], image[6:38], 'sha256') + image[38:]
+   bad = bytearray(listed)
+   bad[len(listed) - total + 2*PAGE_SIZE + 17] ^= 0x01
+
+   failed = False
+   base = None
+   half = {j: image[38 + j*PAGE_SIZE:38 + (j+1)*PAGE_SIZE] for j in range(pages//2)}
+   for name, window, p, flash, img in (('stop-and-wait (unframed)', None, 0, {}, image),
+                                       ('framed, window 1', 1, loss, {}, image),
+                                       ('framed, window 2', 2, loss, {}, image),
+                                       ('window 2, resumed halfway', 2, loss, half, image),
+                                       ('page list, window 1', 1, loss, {}, listed),
+                                       ('page list, bad page 2', 1, loss, {}, bytes(bad))):
+      r = run(img, window, p, latency, dict(flash), img is not image, img is not image and img != listed)
+      if r is None:
+         failed = True
+         print(name, 'FAILED')
+         continue
+      base = base or r[0]
+      print('%-26s %6.2f s  %4.0f B/s  %+5.1f%%  %d resent' % (name, r[0], total / r[0],
+            100.0 * (base - r[0]) / r[0], r[1]))
+   sys.exit(1 if failed else 0)
+
+if __name__ == "__main__":
+   main(sys.argv[1:])
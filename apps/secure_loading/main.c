@@ -1,89 +1,338 @@
 #include <avr/pgmspace.h>
 #include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/crc16.h>
+#include <util/delay.h>
 
 #define BAUD 9600
 #include <util/setbaud.h>
 #include "serial.h"
 #include "microvisor.h"
 
+/* Framed transfer, see serial_loader.py:
+ *   0x7E, seq, length (2), payload, CRC (2)     little endian
+ * with a CRC-16/XMODEM over seq, length and payload. Frame 0 carries the mode
+ * byte and the metadata ('F' full image, 'D' delta with base MAC and bitmap
+ * after the header, lower case: pages come as LZ frames, 'P' full image with
+ * a page list), every further frame one sent page, raw or as an LZ frame
+ * (core/scripts/lz_page.py). For 'P' the page list and its MAC
+ * (core/scripts/ota_pages.py) come first, in frames of up to PAGE_SIZE bytes.
+ *
+ * Replies: 'A' seq once the frame is in flash, 'N' seq with the frame
+ * expected after a bad or unexpected one (once until that one arrives), 'e'
+ * on an error and 'r' for a page that is not the listed one (the transfer
+ * starts over) and 'd' when everything arrived.
+ * 'A' 0 is followed by 'R' and the LOAD_PROGRESS_SIZE byte bitmap of the
+ * pages that are in SHADOW already from an interrupted transfer of the same
+ * image (load_progress()); the loader leaves those out, the frames after
+ * the first carry the remaining pages in order.
+ *
+ * The loader keeps a window of frames in flight. Bytes go into rx from the
+ * receive interrupt and, while the microvisor programs flash with interrupts
+ * off, from the microvisor itself (load_rx()), so the next frame streams in
+ * while the previous page is written. */
+#define FRAME_SOF 0x7E
+#define BITMAP_SIZE LOAD_PROGRESS_SIZE
+#define FRAME_MAX (1 + PAGE_SIZE + MAC_BYTES + BITMAP_SIZE)
 
+#if FRAME_MAX < LZ_FRAME_MAX
+#error "Frame buffer too small for LZ frames!"
+#endif
 
-void clear_buf(uint8_t *buf) {
-  uint16_t i;
-  for(i=0; i<PAGE_SIZE; i++)
-    buf[i]=0xFF;
+// Idle polls of IDLE_US: give up a partial frame after ~20 ms without a
+// byte, a transfer after ~2 s
+#define IDLE_US 100
+#define IDLE_RESYNC 200
+#define IDLE_RESTART 20000
+
+// Receive ring in .bootbss, from load_rx()
+static load_rx_ring_t *rx;
+
+enum { RX_HUNT, RX_SEQ, RX_LEN0, RX_LEN1, RX_DATA, RX_CRC0, RX_CRC1 };
+
+static struct {
+  uint8_t state;
+  uint8_t seq;
+  uint16_t length;
+  uint16_t pos;
+  uint16_t crc;
+  uint16_t idle;
+} rxf;
+
+ISR(USART_RX_vect) {
+  uint8_t head = rx->head;
+  rx->buf[head] = UDR0;
+  head = (head + 1) & (LOAD_RX_SIZE - 1);
+  // Ring full: the byte is lost, the frame CRC catches it
+  if(head != rx->tail)
+    rx->head = head;
+}
+
+// Binary replies: uart_putchar() expands '\n'
+static void send_byte(uint8_t c) {
+  loop_until_bit_is_set(UCSR0A, UDRE0);
+  UDR0 = c;
+}
+
+static void send_reply(char c, uint8_t seq) {
+  send_byte(c);
+  send_byte(seq);
+}
+
+static void send_ack(uint8_t seq, const uint8_t *landed) {
+  uint8_t i;
+
+  send_reply('A', seq);
+  if(seq == 0) {
+    send_byte('R');
+    for(i=0; i<BITMAP_SIZE; i++)
+      send_byte(landed[i]);
+  }
+}
+
+// Feeds received bytes to the frame parser. Returns 1 once a frame with a
+// good CRC is in frame, 0 for a bad frame, -1 if none is complete yet.
+static int8_t frame_poll(uint8_t *frame) {
+  uint8_t c;
+
+  while(rx->tail != rx->head) {
+    c = rx->buf[rx->tail];
+    rx->tail = (rx->tail + 1) & (LOAD_RX_SIZE - 1);
+    rxf.idle = 0;
+
+    if(rxf.state == RX_HUNT) {
+      if(c == FRAME_SOF) {
+        rxf.crc = 0;
+        rxf.state = RX_SEQ;
+      }
+      continue;
+    }
+    if(rxf.state < RX_CRC0)
+      rxf.crc = _crc_xmodem_update(rxf.crc, c);
+
+    switch(rxf.state) {
+    case RX_SEQ:
+      rxf.seq = c;
+      rxf.state = RX_LEN0;
+      break;
+    case RX_LEN0:
+      rxf.length = c;
+      rxf.state = RX_LEN1;
+      break;
+    case RX_LEN1:
+      rxf.length |= (uint16_t) c << 8;
+      rxf.pos = 0;
+      if(rxf.length > FRAME_MAX) {
+        rxf.state = RX_HUNT;
+        return 0;
+      }
+      rxf.state = rxf.length ? RX_DATA : RX_CRC0;
+      break;
+    case RX_DATA:
+      frame[rxf.pos++] = c;
+      if(rxf.pos == rxf.length)
+        rxf.state = RX_CRC0;
+      break;
+    case RX_CRC0:
+      rxf.crc ^= c;
+      rxf.state = RX_CRC1;
+      break;
+    default:
+      rxf.crc ^= (uint16_t) c << 8;
+      rxf.state = RX_HUNT;
+      return rxf.crc == 0;
+    }
+  }
+
+  // Line went quiet inside a frame: bytes were lost, look for the next one
+  if(rxf.idle < IDLE_RESTART)
+    rxf.idle++;
+  if(rxf.state != RX_HUNT && rxf.idle > IDLE_RESYNC) {
+    rxf.state = RX_HUNT;
+    return 0;
+  }
+  return -1;
+}
+
+// Bit j set: page j is sent, otherwise copied from the running app. Same
+// layout for the pages already in SHADOW.
+static uint8_t page_sent(const uint8_t *bitmap, uint16_t j) {
+  return bitmap[j >> 3] & (1 << (j & 0x07));
 }
 
 int main(void) {
-  uint8_t buffer[PAGE_SIZE];
+  uint8_t frame[FRAME_MAX];
+  uint8_t base_mac[MAC_BYTES];
+  uint8_t bitmap[BITMAP_SIZE];
+  uint8_t landed[BITMAP_SIZE];
   uint16_t i;
-  uint16_t j;
+  uint16_t j = 0;
 
   uint16_t total_size;
   uint16_t nr_2ndwords;
+  uint16_t header_size;
+  uint16_t pages = 0;
+  uint16_t list_size = 0;
+  uint16_t list_at = 0;
+  uint8_t delta;
+  uint8_t compressed = 0;
+  uint8_t expect = 0;
+  uint8_t nak = 0;
+  uint8_t copy = 0;
+  uint8_t ok;
+  int8_t got = -1;
 
   uart_init();
+  rx = load_rx(1);
+  UCSR0B |= _BV(RXCIE0);
+  sei();
 
+  while(1) {
+    if(got < 0)
+      got = frame_poll(frame);
 
+    // Copy unchanged pages up to the next one that is sent before
+    // acknowledging the frame before them: the loader sends no more than its
+    // window meanwhile, and the parser above keeps taking it in. Pages that
+    // landed before need neither.
+    if(copy) {
+      if(j < pages && page_sent(landed, j)) {
+        j++;
+        continue;
+      }
+      if(j < pages && !page_sent(bitmap, j)) {
+        if(load_image_copy(PAGE_SIZE*j, base_mac)) {
+          j++;
+          continue;
+        }
+        // Installed image is not the delta base
+        uart_putchar('e');
+        copy = 0;
+        expect = 0;
+        continue;
+      }
+      copy = 0;
+      send_ack(expect - 1, landed);
+      if(j < pages || list_at < list_size)
+        continue;
 
-  while(1) {
-    // No memset support!
-    clear_buf(buffer);
-
-    // Total size (Arrives little endian, NOT network order!)
-    buffer[0] = uart_getchar();
-    buffer[1] = uart_getchar();
-    total_size = buffer[1]<<8 | buffer[0];
-
-    // Data start
-    buffer[2] = uart_getchar();
-    buffer[3] = uart_getchar();
-
-    // Nr 2nd words (Arrives little endian, NOT network order!)
-    buffer[4] = uart_getchar();
-    buffer[5] = uart_getchar();
-    nr_2ndwords = buffer[5]<<8 | buffer[4];
-
-    // Unsafe 2nd words
-    for(i=0; i<nr_2ndwords; i++) {
-      buffer[6+i*2] = uart_getchar();
-      buffer[7+i*2] = uart_getchar();
-    }
+      // Everything received, done
+      uart_putchar('d');
+      expect = 0;
 
-    // HMAC digest (20 bytes)
-    for(i=0; i<20; i++) {
-      buffer[6+nr_2ndwords*2+i] = uart_getchar();
+      // Verify and activate if secure
+      verify_activate_image();
+      continue;
     }
 
-    // Write to flash + ready to receive more
-    load_image(buffer, METADATA_OFFSET);
-    uart_putchar('o');
-
-    // Round down total_size/PAGE_SIZE to get amount of full pages to write
-    for(j=0; j < total_size/PAGE_SIZE; j++) {
-      for(i=0; i<PAGE_SIZE; i++) {
-        buffer[i] = uart_getchar();
+    if(got < 0) {
+      // Loader went away in the middle of a transfer
+      if(rxf.idle == IDLE_RESTART) {
+        expect = 0;
+        nak = 0;
       }
-      load_image(buffer, PAGE_SIZE*j);
-      uart_putchar('o');
+      _delay_us(IDLE_US);
+      continue;
     }
 
-    // Receive last (incomplete) page
-    if(total_size%PAGE_SIZE) {
-      // No memset support!
-      clear_buf(buffer);
-      // Write possible last incomplete page..
-      for(i=0; i<(total_size%PAGE_SIZE); i++) {
-        buffer[i] = uart_getchar();
+    if(!got || rxf.seq != expect) {
+      if(got && rxf.seq == (uint8_t) (expect - 1))
+        // Our 'A' got lost, the frame is in flash already
+        send_ack(rxf.seq, landed);
+      else if(!nak) {
+        send_reply('N', expect);
+        nak = 1;
       }
-      load_image(buffer, PAGE_SIZE*j);
-      uart_putchar('o');
+      got = -1;
+      continue;
     }
+    got = -1;
+    nak = 0;
 
-    // Everything received, done
-    uart_putchar('d');
+    if(expect == 0) {
+      // Mode, then total size, data start, nr 2nd words (little endian, NOT
+      // network order!), unsafe 2nd words and the MAC digest
+      delta = (frame[0] == 'D' || frame[0] == 'd');
+      compressed = (frame[0] == 'f' || frame[0] == 'd');
+      total_size = frame[2]<<8 | frame[1];
+      nr_2ndwords = frame[6]<<8 | frame[5];
+      header_size = 6 + nr_2ndwords*2 + MAC_BYTES;
+      pages = total_size/PAGE_SIZE + (total_size%PAGE_SIZE > 0);
+      // Page list with its MAC follows, see load_page_list()
+      list_size = (frame[0] == 'P') ? pages*PAGE_HASH_BYTES + MAC_BYTES : 0;
+
+      if(rxf.length < 7 || header_size > PAGE_SIZE
+          || pages > METADATA_OFFSET/PAGE_SIZE
+          || rxf.length < 1 + header_size + (delta ? MAC_BYTES + (pages+7)/8 : 0)) {
+        uart_putchar('e');
+        continue;
+      }
+
+      // Delta: MAC of the image it applies to, then which pages follow
+      for(i=0; i<sizeof(bitmap); i++)
+        bitmap[i] = 0xFF;
+      if(delta) {
+        for(i=0; i<MAC_BYTES; i++)
+          base_mac[i] = frame[1 + header_size + i];
+        for(i=0; i<(pages+7)/8; i++)
+          bitmap[i] = frame[1 + header_size + MAC_BYTES + i];
+      }
+
+      // Resuming the same image: its pages in SHADOW stay. Ask before the
+      // header is written, the microvisor then keeps the progress.
+      load_progress(frame + 1 + header_size - MAC_BYTES, landed);
+
+      // Header to the start of the page, no memset/memmove support!
+      for(i=0; i<header_size; i++)
+        frame[i] = frame[i + 1];
+      for(; i<PAGE_SIZE; i++)
+        frame[i] = 0xFF;
+
+      // Write to flash
+      load_image(frame, METADATA_OFFSET);
+      j = 0;
+      list_at = 0;
+    } else if(list_at < list_size) {
+      // The part with the MAC puts the list in force
+      ok = 0;
+      if(rxf.length <= list_size - list_at)
+        ok = load_page_list(frame, list_at, rxf.length);
+      list_at += rxf.length;
+      if(list_at == list_size && ok != 2)
+        ok = 0;
+      if(!ok) {
+        uart_putchar('e');
+        expect = 0;
+        continue;
+      }
+    } else {
+      if(j >= pages) {
+        ok = 0;
+      } else if(compressed) {
+        ok = load_image_lz(frame, rxf.length, PAGE_SIZE*j);
+      } else {
+        // Last page may be incomplete
+        ok = (rxf.length <= PAGE_SIZE);
+        if(ok) {
+          for(i=rxf.length; i<PAGE_SIZE; i++)
+            frame[i] = 0xFF;
+          // Refused before it is written, the rest need not come
+          if(!load_image(frame, PAGE_SIZE*j)) {
+            uart_putchar('r');
+            expect = 0;
+            continue;
+          }
+        }
+      }
+      if(!ok) {
+        uart_putchar('e');
+        expect = 0;
+        continue;
+      }
+      j++;
+    }
 
-    // Verify and activate if secure
-    verify_activate_image();
+    expect++;
+    copy = 1;
   }
 }
@@ -1,13 +1,179 @@
 #!/usr/bin/env python3
-import sys, os, struct, time
+# Sends an OTA image to secure_loading in CRC framed pages, see main.c there:
+#   0x7E, seq, length (2), payload, CRC-16/XMODEM (2)
+# Frame 0 is the mode byte and metadata, then one frame per sent page. Up to
+# --window frames are in flight (go-back-N on 'N' or a timeout); --window 1
+# is stop-and-wait. The answer to frame 0 says which pages are in flash from
+# an interrupted run with the same image, only the others are sent. Images
+# from ota_pages.py (--pages) send their page list before the pages; the
+# device checks each page against it before writing and answers 'r' for a
+# bad one. That check keeps interrupts off for as long as a page takes to
+# arrive, so these go stop-and-wait unless --window says otherwise.
+import sys, os, struct, time, binascii
 sys.path += [ os.path.join(os.path.split(__file__)[0], 'libs') ]
+sys.path += [ os.path.join(os.path.split(__file__)[0], '../../core/scripts') ]
 import serial
+import mac_engine
 
 PAGE_SIZE = 256
+# LOAD_PROGRESS_SIZE in core/microvisor.h
+PROGRESS_SIZE = 7
+# PAGE_HASH_BYTES in core/microvisor.h
+PAGE_HASH_BYTES = 8
+FRAME_SOF = 0x7E
+# The device keeps one frame in its parser and one in its receive ring
+WINDOW = 2
+# No reply for this long: resend from the oldest unacknowledged frame
+TIMEOUT = 2.0
+RETRIES = 8
+# Longer than the device takes to drop a broken frame (~20 ms)
+RESYNC = 0.05
+
+class LoadError(Exception):
+   pass
+
+def frame(seq, payload):
+   body = struct.pack("<BH", seq & 0xFF, len(payload)) + payload
+   return bytes((FRAME_SOF,)) + body + struct.pack("<H", binascii.crc_hqx(body, 0))
+
+# Frame payloads for an image file from ota_image.py, ota_delta.py or
+# ota_pages.py, and the page index of each payload after the first (None for
+# a part of the page list)
+def payloads(filecontent, delta, lz, mac, listed=False):
+   # Decode some stuff from metadata header..
+   total = struct.unpack("<H", filecontent[:2])[0]
+   #data = struct.unpack("<H", filecontent[2:4])[0]
+   twoword = struct.unpack("<H", filecontent[4:6])[0]
+
+   # Calculate metadata header size
+   header_size = 6 + (2 * twoword) + mac_engine.tag_bytes(mac)
+
+   # Pages to send: all of them, or those set in the delta bitmap after the
+   # base MAC
+   pages = (total + PAGE_SIZE - 1)//PAGE_SIZE
+   if delta:
+      bitmap = filecontent[header_size + mac_engine.tag_bytes(mac):][:(pages + 7)//8]
+      header_size += mac_engine.tag_bytes(mac) + len(bitmap)
+      sent = [i for i in range(pages) if bitmap[i >> 3] & (1 << (i & 0x07))]
+   else:
+      sent = list(range(pages))
+
+   # Mode + metadata ('D' also carries base MAC and bitmap, lower case for LZ
+   # frames, 'P' has the page list and its MAC after the header)
+   if listed:
+      out = [b'P' + filecontent[:header_size]]
+      size = pages*PAGE_HASH_BYTES + mac_engine.tag_bytes(mac)
+      parts = filecontent[header_size:header_size + size]
+      out += [parts[i:i+PAGE_SIZE] for i in range(0, size, PAGE_SIZE)]
+      sent = [None]*(len(out) - 1) + sent
+      header_size += size
+   else:
+      mode = b'D' if delta else b'F'
+      out = [(mode.lower() if lz else mode) + filecontent[:header_size]]
+
+   data = filecontent[header_size:]
+   for i in sent:
+      if i is None:
+         continue
+      if lz:
+         # Frame without its 2 byte size, the frame length says it
+         size = struct.unpack("<H", data[:2])[0]
+         out.append(data[2:2+size])
+         data = data[2+size:]
+      else:
+         # Last page may be incomplete
+         size = min(PAGE_SIZE, total - i*PAGE_SIZE)
+         out.append(data[:size])
+         data = data[size:]
+   return out, sent
+
+# Sends the payloads as frames first, first + 1, .. with up to window frames
+# unacknowledged, returns the number of frames sent again
+def transfer(ser, payloads, window=WINDOW, log=print, first=0):
+   frames = [frame(first + i, p) for i, p in enumerate(payloads)]
+   ser.timeout = TIMEOUT
+   base = 0     # oldest frame not acknowledged
+   nxt = 0      # next frame to send
+   resent = 0
+   retries = 0
+   while base < len(frames):
+      while nxt < len(frames) and nxt - base < window:
+         ser.write(frames[nxt])
+         nxt += 1
+
+      answer = ser.read()
+      if not answer:
+         retries += 1
+         if retries > RETRIES:
+            raise LoadError('no answer from the device')
+         log('timeout, resending from frame', base)
+         resent += nxt - base
+         nxt = base
+         continue
+      if answer == b'e':
+         raise LoadError('installed image does not match the delta base, or bad frame')
+      if answer == b'r':
+         raise LoadError('page in frame %d is not the listed one, image refused' % base)
+      if answer not in (b'A', b'N'):
+         continue
+      seq = ser.read()
+      if not seq:
+         continue
+      # Sequence numbers are the frame number mod 256, window < 128
+      index = base + ((seq[0] - first - base) & 0xFF)
+      if answer == b'A':
+         if index < nxt:
+            base = index + 1
+            retries = 0
+      elif index <= nxt:
+         # Everything before index is in flash, go back to it once the device
+         # dropped what is still coming in
+         log('frame', index, 'rejected, resending')
+         base = index
+         resent += nxt - index
+         ser.flush()
+         time.sleep(RESYNC)
+         nxt = index
+   return resent
+
+# Header frame alone, then the page list if any and the pages the device does
+# not have yet. Returns (frames resent, pages left out)
+def load(ser, payloads, sent, window=WINDOW, log=print):
+   resent = transfer(ser, payloads[:1], window, log)
+   if ser.read() != b'R':
+      raise LoadError('no progress from the device')
+   landed = ser.read(PROGRESS_SIZE)
+   if len(landed) != PROGRESS_SIZE:
+      raise LoadError('no progress from the device')
+   rest = [p for p, i in zip(payloads[1:], sent)
+           if i is None or not landed[i >> 3] & (1 << (i & 0x07))]
+   if len(rest) < len(sent):
+      log('resuming,', len(sent) - len(rest), 'of', sum(i is not None for i in sent),
+          'pages are in place')
+   resent += transfer(ser, rest, window, log, first=1)
+   return resent, len(sent) - len(rest)
 
 def main(argv):
+   # Delta images come from ota_delta.py, full ones from ota_image.py, both
+   # with --lz if they were made with it
+   delta = '--delta' in argv
+   lz = '--lz' in argv
+   listed = '--pages' in argv
+   argv = [a for a in argv if a not in ('--delta', '--lz', '--pages')]
+   mac = mac_engine.parse_arg(argv)
+   window = 1 if listed else WINDOW
+   if '--window' in argv:
+      i = argv.index('--window')
+      if i + 1 >= len(argv) or not argv[i+1].isdigit() or not 0 < int(argv[i+1]) < 128:
+         print('ERROR: --window takes 1..127')
+         sys.exit(2)
+      window = int(argv[i+1])
+      del argv[i:i+2]
    if len(argv) != 2:
-      print('serial_loader.py <binfile> <serialport>')
+      print('serial_loader.py [--delta] [--lz] [--pages] [--window <frames>] [--mac sha256|sha1|blake2s] <binfile> <serialport>')
+      sys.exit(2)
+   if listed and (delta or lz):
+      print('ERROR: --pages images are full images')
       sys.exit(2)
 
    # Check if binfile exists
@@ -20,49 +186,22 @@ def main(argv):
    time.sleep(3)
    print('opened connection!')
 
-
    f = open(binfile, "rb")
    filecontent = f.read()
 
-   # Decode some stuff from metadata header..
-   total = struct.unpack("<H", filecontent[:2])[0]
-   #data = struct.unpack("<H", filecontent[2:4])[0]
-   twoword = struct.unpack("<H", filecontent[4:6])[0]
-
-   # Calculate metadata header size
-   header_size = 6 + (2 * twoword) + 20
-
-   # Write metadata
-   ser.write(filecontent[:header_size])
-
-   # Wait for answer 'o' --> OK
-   answer = ser.read()
-   #while answer != b'o':
-   #    answer = ser.read()
-   print(answer)
-
-   for i in range(0,total//PAGE_SIZE):
-       ser.write(filecontent[header_size+(PAGE_SIZE*i):header_size+PAGE_SIZE*(i+1)])
-
-       # Wait for answer 'o' --> OK
-       answer = ser.read()
-     #  while answer != b'o':
-      #     answer = ser.read()
-       print(answer)
-
-   if total%PAGE_SIZE:
-       ser.write(filecontent[-(total%PAGE_SIZE):])
-
-       # Wait for answer 'o' --> OK
-       answer = ser.read()
-     #  while answer != b'o':
-     #     answer = ser.read()
-       print(answer)
+   frames, sent = payloads(filecontent, delta, lz, mac, listed)
+   start = time.time()
+   try:
+      resent, skipped = load(ser, frames, sent, window)
+   except LoadError as e:
+      print('ERROR:', e)
+      sys.exit(1)
+   elapsed = time.time() - start
+   print('%d frames (%d resent, %d pages in place) in %.2f s' % (len(frames), resent,
+         skipped, elapsed))
 
    # Wait for answer 'd' --> Done
    answer = ser.read()
-   #while answer != b'd':
-   #    answer = ser.read()
    print(answer)
 
 if __name__ == "__main__":
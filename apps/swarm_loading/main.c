@@ -0,0 +1,159 @@
+#include <avr/pgmspace.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/crc16.h>
+#include <util/delay.h>
+
+#define BAUD 9600
+#include <util/setbaud.h>
+#include "serial.h"
+#include "microvisor.h"
+
+/* Broadcast OTA prover, see swarm_loader.py. The radio bridge on the UART
+ * hands over every message the verifier broadcasts as
+ *   0x7E, length, message, CRC (2)              little endian
+ * with a CRC-16/XMODEM over length and message, and sends the answers the
+ * same way. Messages are parse_att_msg() style (OTA_CHUNK_MSG_SIZE): the
+ * microvisor collects the chunks in page, writes complete pages and keeps
+ * track of them (parse_ota_msg()); nothing is acknowledged. ota_status
+ * requests get the bitmap of the missing pages, the verifier sends those
+ * again. Once the image is complete it is verified and activated. */
+#define FRAME_SOF 0x7E
+#define MSG_MAX 100
+
+#if MSG_MAX < OTA_CHUNK_MSG_SIZE
+#error "Message buffer too small for OTA chunks!"
+#endif
+
+// Idle polls of IDLE_US: give up a partial message after ~20 ms without a
+// byte
+#define IDLE_US 100
+#define IDLE_RESYNC 200
+
+// Receive ring in .bootbss, from load_rx()
+static load_rx_ring_t *rx;
+
+enum { RX_HUNT, RX_LEN, RX_DATA, RX_CRC0, RX_CRC1 };
+
+static struct {
+  uint8_t state;
+  uint8_t length;
+  uint8_t pos;
+  uint16_t crc;
+  uint16_t idle;
+} rxf;
+
+ISR(USART_RX_vect) {
+  uint8_t head = rx->head;
+  rx->buf[head] = UDR0;
+  head = (head + 1) & (LOAD_RX_SIZE - 1);
+  // Ring full: the byte is lost, the message CRC catches it
+  if(head != rx->tail)
+    rx->head = head;
+}
+
+// Binary replies: uart_putchar() expands '\n'
+static void send_byte(uint8_t c) {
+  loop_until_bit_is_set(UCSR0A, UDRE0);
+  UDR0 = c;
+}
+
+static void send_msg(const uint8_t *msg, uint8_t length) {
+  uint16_t crc = _crc_xmodem_update(0, length);
+  uint8_t i;
+
+  send_byte(FRAME_SOF);
+  send_byte(length);
+  for(i=0; i<length; i++) {
+    send_byte(msg[i]);
+    crc = _crc_xmodem_update(crc, msg[i]);
+  }
+  send_byte(crc & 0xFF);
+  send_byte(crc >> 8);
+}
+
+// Feeds received bytes to the message parser. Returns the length once a
+// message with a good CRC is in msg, 0 if none is complete yet. Broken ones
+// are dropped: the page they belong to shows up in the next status.
+static uint8_t msg_poll(uint8_t *msg) {
+  uint8_t c;
+
+  while(rx->tail != rx->head) {
+    c = rx->buf[rx->tail];
+    rx->tail = (rx->tail + 1) & (LOAD_RX_SIZE - 1);
+    rxf.idle = 0;
+
+    if(rxf.state == RX_HUNT) {
+      if(c == FRAME_SOF) {
+        rxf.crc = 0;
+        rxf.state = RX_LEN;
+      }
+      continue;
+    }
+    if(rxf.state < RX_CRC0)
+      rxf.crc = _crc_xmodem_update(rxf.crc, c);
+
+    switch(rxf.state) {
+    case RX_LEN:
+      rxf.length = c;
+      rxf.pos = 0;
+      if(c == 0 || c > MSG_MAX)
+        rxf.state = RX_HUNT;
+      else
+        rxf.state = RX_DATA;
+      break;
+    case RX_DATA:
+      msg[rxf.pos++] = c;
+      if(rxf.pos == rxf.length)
+        rxf.state = RX_CRC0;
+      break;
+    case RX_CRC0:
+      rxf.crc ^= c;
+      rxf.state = RX_CRC1;
+      break;
+    default:
+      rxf.crc ^= (uint16_t) c << 8;
+      rxf.state = RX_HUNT;
+      if(rxf.crc == 0)
+        return rxf.length;
+    }
+  }
+
+  // Line went quiet inside a message: bytes were lost, wait for the next one
+  if(rxf.idle <= IDLE_RESYNC)
+    rxf.idle++;
+  else
+    rxf.state = RX_HUNT;
+  return 0;
+}
+
+int main(void) {
+  uint8_t msg[MSG_MAX];
+  uint8_t result[OTA_STATUS_RESP_SIZE];
+  uint8_t page[PAGE_SIZE];
+  uint8_t length;
+  int8_t retval;
+
+  uart_init();
+  // Messages keep coming while a page is written
+  rx = load_rx(1);
+  UCSR0B |= _BV(RXCIE0);
+  sei();
+
+  while(1) {
+    length = msg_poll(msg);
+    if(!length) {
+      _delay_us(IDLE_US);
+      continue;
+    }
+
+    retval = parse_ota_msg(msg, length, result, page);
+    if(retval == 4) {
+      send_msg(result, OTA_STATUS_RESP_SIZE);
+    } else if(retval == 3) {
+      // Whole image in SHADOW: verify and activate if secure, a bad image
+      // stays where it is and the next status says so
+      verify_activate_image();
+    }
+  }
+}
@@ -0,0 +1,11 @@
+
+void uart_init(void);
+
+char uart_getchar();
+
+void uart_putchar(char c);
+
+void uart_puts(char *c);
+
+
+
@@ -0,0 +1,281 @@
+#!/usr/bin/env python3
+# Broadcasts an OTA image (ota_image.py, no delta or LZ) to a swarm of
+# swarm_loading provers, see parse_ota_msg() in core/microvisor.c:
+#
+#   swarm_loader.py [--mac sha256|sha1|blake2s] <binfile> <serialport> [<serialport> ..]
+#   swarm_loader.py [--mac ..] --simulate <provers> [--loss <probability>] <binfile>
+#
+# Every round sends the pages still missing somewhere once, as ota_chunk
+# messages to all provers, then asks each one with ota_status which pages it
+# misses (NACK bitmap). The next round sends only the union of those, so the
+# number of rounds grows with the loss rate and barely with the swarm size.
+# With serial ports, each one is the radio bridge of one prover and a
+# broadcast is a write to all of them. --simulate runs the same rounds
+# against models of the provers that lose each message with the given
+# probability, and compares the messages sent with one unicast transfer per
+# prover.
+import sys, os, struct, time, random, binascii
+sys.path += [ os.path.join(os.path.split(__file__)[0], '../secure_loading/libs') ]
+sys.path += [ os.path.join(os.path.split(__file__)[0], '../../core/scripts') ]
+import mac_engine
+
+PAGE_SIZE = 256
+# OTA_* in core/microvisor.h
+TAG_BYTES = 4
+CHUNK_BYTES = 64
+CHUNKS = PAGE_SIZE//CHUNK_BYTES
+HEADER_PAGE = 0xFF
+PROGRESS_SIZE = 7
+STATUS_RESP_SIZE = 47 + PROGRESS_SIZE
+STATE_RECEIVING, STATE_NO_HEADER, STATE_INSTALLED = 0, 1, 2
+
+VERIFIER_MAC = bytes((0x02, 0x00, 0x00, 0x99, 0x99, 0x99))
+BROADCAST_MAC = b'\xff'*6
+CHUNK_KWRD = b'\xcc'*8
+STATUS_KWRD = b'\xdd'*8
+STATUS_RESP_KWRD = b'\xee'*8
+
+FRAME_SOF = 0x7E
+# Per status request and prover
+TIMEOUT = 1.0
+STATUS_RETRIES = 2
+ROUNDS = 32
+# Scan and MAC of the whole image before the app is replaced
+ACTIVATE = 3.0
+
+class LoadError(Exception):
+   pass
+
+# {page: PAGE_SIZE bytes}, header under HEADER_PAGE, and the image tag
+def pages_of(filecontent, mac):
+   total = struct.unpack("<H", filecontent[:2])[0]
+   twoword = struct.unpack("<H", filecontent[4:6])[0]
+   header_size = 6 + (2 * twoword) + mac_engine.tag_bytes(mac)
+   if header_size > PAGE_SIZE:
+      raise LoadError('metadata header does not fit a page')
+   tag = filecontent[header_size - mac_engine.tag_bytes(mac):][:TAG_BYTES]
+   pad = lambda b: b + b'\xff'*(PAGE_SIZE - len(b))
+   pages = {HEADER_PAGE: pad(filecontent[:header_size])}
+   data = filecontent[header_size:]
+   for i in range((total + PAGE_SIZE - 1)//PAGE_SIZE):
+      pages[i] = pad(data[i*PAGE_SIZE:min((i+1)*PAGE_SIZE, total)])
+   return pages, tag
+
+def chunk_msg(tag, page, chunk, data):
+   return (BROADCAST_MAC + VERIFIER_MAC + bytes(2) + CHUNK_KWRD + tag
+           + bytes((page, chunk)) + data[chunk*CHUNK_BYTES:(chunk+1)*CHUNK_BYTES])
+
+def status_msg(ctr, nonce, tag):
+   return BROADCAST_MAC + VERIFIER_MAC + bytes(2) + STATUS_KWRD + struct.pack("<H", ctr) + nonce + tag
+
+# (prover id, state, missing pages) of a status response for tag, or None
+def parse_status(resp, tag):
+   if len(resp) < STATUS_RESP_SIZE or resp[34:42] != STATUS_RESP_KWRD or resp[42:46] != tag:
+      return None
+   nack = resp[47:STATUS_RESP_SIZE]
+   missing = {i for i in range(8*PROGRESS_SIZE) if nack[i >> 3] & (1 << (i & 0x07))}
+   return struct.unpack("<H", resp[14:16])[0], resp[46], missing
+
+# Header first: provers drop image pages until they have it
+def round_msgs(pages, tag, wanted):
+   order = sorted(wanted, key=lambda p: -1 if p == HEADER_PAGE else p)
+   return [chunk_msg(tag, p, c, pages[p]) for p in order for c in range(CHUNKS)]
+
+# Rounds until no prover misses a page. broadcast(msg) sends to all,
+# status(i, msg) returns prover i's response or None. Returns (rounds,
+# messages broadcast, {prover: state}).
+def disseminate(pages, tag, n, broadcast, status, log=print):
+   # Last known missing pages per prover
+   missing = [set(pages) for _ in range(n)]
+   wanted = set(pages)
+   states = {}
+   sent = 0
+   ctr = 0
+   for r in range(1, ROUNDS + 1):
+      for m in round_msgs(pages, tag, wanted):
+         broadcast(m)
+         sent += 1
+
+      for i in range(n):
+         answer = None
+         for _ in range(STATUS_RETRIES + 1):
+            ctr += 1
+            answer = parse_status(status(i, status_msg(ctr, os.urandom(16), tag)) or b'', tag)
+            if answer:
+               break
+         if not answer:
+            # Unreachable this round: it misses what it missed before, at most
+            log('prover', i, 'did not answer')
+            continue
+         _, states[i], nack = answer
+         if states[i] == STATE_NO_HEADER:
+            missing[i] = set(pages)
+         elif states[i] == STATE_RECEIVING:
+            missing[i] = nack & set(pages)
+         else:
+            missing[i] = set()
+      wanted = set().union(*missing)
+      log('round %d: %d pages missing' % (r, len(wanted)))
+      if not wanted:
+         return r, sent, states
+   raise LoadError('still pages missing after %d rounds' % ROUNDS)
+
+# Prover side of parse_ota_msg(), without flash
+class Prover:
+   def __init__(self, ident, loss, rng):
+      self.ident = ident
+      self.loss = loss
+      self.rng = rng
+      self.tag = None
+      self.npages = 0
+      self.have = set()
+      self.buf = None
+      self.chunks = set()
+
+   def receive(self, msg):
+      if self.rng.random() < self.loss:
+         return None
+      if msg[14:22] == STATUS_KWRD:
+         tag = msg[40:44]
+         if self.tag == tag:
+            state = STATE_RECEIVING
+            missing = set(range(self.npages)) - self.have
+         else:
+            state, missing = STATE_NO_HEADER, set(range(8*PROGRESS_SIZE))
+         nack = bytearray(PROGRESS_SIZE)
+         for i in missing:
+            nack[i >> 3] |= 1 << (i & 0x07)
+         resp = (VERIFIER_MAC + bytes(8) + struct.pack("<H", self.ident) + msg[22:40]
+                 + STATUS_RESP_KWRD + tag + bytes((state,)) + bytes(nack))
+         # The response goes over the same lossy link
+         return None if self.rng.random() < self.loss else resp
+      tag, page, chunk = msg[22:26], msg[26], msg[27]
+      if page == HEADER_PAGE:
+         if self.tag == tag:
+            return None
+      elif self.tag != tag or page in self.have:
+         return None
+      if self.buf != (tag, page):
+         self.buf = (tag, page)
+         self.chunks = set()
+         self.data = bytearray(PAGE_SIZE)
+      self.data[chunk*CHUNK_BYTES:(chunk+1)*CHUNK_BYTES] = msg[28:]
+      self.chunks.add(chunk)
+      if len(self.chunks) < CHUNKS:
+         return None
+      self.buf = None
+      if page == HEADER_PAGE:
+         self.tag = tag
+         self.have = set()
+         total = self.data[0] | self.data[1] << 8
+         self.npages = (total + PAGE_SIZE - 1)//PAGE_SIZE
+      else:
+         self.have.add(page)
+      return None
+
+# (rounds, messages) for n provers at the given loss
+def simulate(pages, tag, n, loss, seed=1):
+   rng = random.Random(seed)
+   provers = [Prover(i, loss, rng) for i in range(n)]
+   def broadcast(m):
+      for p in provers:
+         p.receive(m)
+   rounds, sent, _ = disseminate(pages, tag, n, broadcast,
+                                 lambda i, m: provers[i].receive(m), log=lambda *a: None)
+   return rounds, sent
+
+def frame(msg):
+   body = bytes((len(msg),)) + msg
+   return bytes((FRAME_SOF,)) + body + struct.pack("<H", binascii.crc_hqx(body, 0))
+
+# Next framed message from ser, None after TIMEOUT
+def read_frame(ser):
+   ser.timeout = TIMEOUT
+   deadline = time.time() + TIMEOUT
+   while time.time() < deadline:
+      c = ser.read()
+      if c != bytes((FRAME_SOF,)):
+         continue
+      n = ser.read()
+      if not n:
+         return None
+      body = n + ser.read(n[0] + 2)
+      if len(body) == n[0] + 3 and binascii.crc_hqx(body[:-2], 0) == struct.unpack("<H", body[-2:])[0]:
+         return body[1:-2]
+   return None
+
+def main(argv):
+   mac = mac_engine.parse_arg(argv)
+   opts = {'--simulate': None, '--loss': '0.05'}
+   for o in opts:
+      if o in argv:
+         i = argv.index(o)
+         if i + 1 >= len(argv):
+            argv = []
+            break
+         opts[o] = argv[i+1]
+         del argv[i:i+2]
+   if len(argv) < (1 if opts['--simulate'] else 2):
+      print('swarm_loader.py [--mac sha256|sha1|blake2s] <binfile> <serialport> [<serialport> ..]')
+      print('swarm_loader.py [--mac ..] --simulate <provers> [--loss <probability>] <binfile>')
+      sys.exit(2)
+
+   # Check if binfile exists
+   binfile = argv[0]
+   if not os.path.isfile(binfile):
+      print("ERROR: File not found:", binfile)
+      sys.exit(2)
+   f = open(binfile, "rb")
+   try:
+      pages, tag = pages_of(f.read(), mac)
+   except LoadError as e:
+      print('ERROR:', e)
+      sys.exit(1)
+
+   if opts['--simulate']:
+      loss = float(opts['--loss'])
+      # One message per chunk; unicast needs at least that per prover
+      once = len(pages)*CHUNKS
+      print('%d pages + header, %d messages per copy, loss %.2f' % (len(pages) - 1, once, loss))
+      for n in sorted({1, 10, 100, int(opts['--simulate'])}):
+         rounds, sent = simulate(pages, tag, n, loss)
+         print('%4d provers: %2d rounds %6d messages  (unicast >= %d)' % (n, rounds, sent,
+               n*once))
+      sys.exit(0)
+
+   import serial
+   ports = [serial.Serial(p, 9600) for p in argv[1:]]
+   time.sleep(3)
+   print('opened', len(ports), 'connections!')
+
+   def broadcast(m):
+      for s in ports:
+         s.write(frame(m))
+      # Let the slowest link drain before the next message
+      for s in ports:
+         s.flush()
+   def status(i, m):
+      ports[i].reset_input_buffer()
+      ports[i].write(frame(m))
+      return read_frame(ports[i])
+
+   start = time.time()
+   try:
+      rounds, sent, states = disseminate(pages, tag, len(ports), broadcast, status)
+   except LoadError as e:
+      print('ERROR:', e)
+      sys.exit(1)
+   print('%d messages in %d rounds, %.2f s' % (sent, rounds, time.time() - start))
+
+   # Each prover verifies and activates on its own now
+   time.sleep(ACTIVATE)
+   failed = 0
+   for i in range(len(ports)):
+      answer = parse_status(status(i, status_msg(0, os.urandom(16), tag)) or b'', tag)
+      installed = answer is not None and answer[1] == STATE_INSTALLED
+      failed += not installed
+      print(argv[1 + i], 'installed' if installed else 'NOT installed')
+   sys.exit(1 if failed else 0)
+
+if __name__ == "__main__":
+   main(sys.argv[1:])
@@ -158,6 +158,23 @@ SECTIONS
      *(.bootloader)
      *(.bootmem)
   }
+  /* Build-time attestation midstate, at BOOT_MIDSTATE in mem_layout.h */
+  .bootmid 0x7FE0 :
+  {
+    KEEP(*(.bootmid))
+  }
+  ASSERT (ADDR(.bootloader) + SIZEOF(.bootloader) <= 0x7FE0,
+          "microvisor does not fit below .bootmid, drop features in core/Makefile.include")
+  /* Microvisor-owned RAM. Placed first in data memory so its address does not
+   * depend on the size of the application linked against the microvisor. Not
+   * initialized or cleared by the application's crt. */
+  .bootbss (NOLOAD) :
+  {
+     PROVIDE (__bootbss_start = .) ;
+    *(.bootbss)
+     *(.bootbss*)
+     PROVIDE (__bootbss_end = .) ;
+  }  > data
   .data          :
   {
      PROVIDE (__data_start = .) ;
@@ -7,6 +7,13 @@
  * custom linker script to optimize this. */
 #define BOOTLOADER_PROGMEM __attribute__((section(".bootmem")))
 
+/* This modifier moves a variable into microvisor-owned RAM (.bootbss). The
+ * linker script places this section at the start of SRAM, so the microvisor
+ * finds its state at the same address whatever app image is running. The
+ * section is NOT cleared at reset: state kept here must carry its own validity
+ * marker. */
+#define BOOTLOADER_BSS __attribute__((section(".bootbss")))
+
 /* Compacter then pgm_read_word_far, but requires manual management of RAMPZ
  * (17th bit) + expects only a 16bit address. No hassle with 32bit variables. */
 #define pgm_read_word_far_no_rampz(addr)    \
@@ -0,0 +1,191 @@
+/* blake2s.c */
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+ * \file		blake2s.c
+ * \license		GPLv3 or later
+ * \brief BLAKE2s-256 implementation (RFC 7693), keyed mode as MAC.
+ *
+ * Ten rounds of eight G functions on 32 bit words, with rotations by 16, 12,
+ * 8 and 7 only, and no message schedule: the permutation table picks the
+ * message words per round. State and message words stay little endian, as
+ * on AVR, so no byte swapping is needed either way.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <avr/boot.h>
+#include <avr/pgmspace.h>
+#include "bootloader_progmem.h"
+#include "blake2s.h"
+#include "string_boot.h"
+
+/* Code and tables live in the microvisor section, as the SHA-256 cores */
+BOOTLOADER_PROGMEM static const uint32_t blake2s_iv[8] = {
+	0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+	0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19 };
+
+BOOTLOADER_PROGMEM static const uint8_t blake2s_sigma[10][16] = {
+	{  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+	{ 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 },
+	{ 11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4 },
+	{  7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8 },
+	{  9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13 },
+	{  2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9 },
+	{ 12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11 },
+	{ 13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10 },
+	{  6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5 },
+	{ 10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13,  0 } };
+
+/* v[] indices (a, b, c, d) of the four column and four diagonal G calls,
+ * packed as two nibbles per byte */
+BOOTLOADER_PROGMEM static const uint8_t blake2s_g[8][2] = {
+	{ 0x04, 0x8C }, { 0x15, 0x9D }, { 0x26, 0xAE }, { 0x37, 0xBF },
+	{ 0x05, 0xAF }, { 0x16, 0xBC }, { 0x27, 0x8D }, { 0x34, 0x9E } };
+
+/*************************************************************************/
+
+BOOTLOADER_SECTION
+static uint32_t rotr32(uint32_t x, uint8_t n){
+	return ((x>>n) | (x<<(32-n)));
+}
+
+BOOTLOADER_SECTION
+static void blake2s_load_iv(uint32_t *dest){
+	uint8_t i;
+
+	for(i=0; i<8; ++i){
+		dest[i] = pgm_read_dword(&blake2s_iv[i]);
+	}
+}
+
+/**
+ * compresses the 16 message words in m into state, the counter must already
+ * include this block
+ */
+BOOTLOADER_SECTION
+static void blake2s_compress(blake2s_ctx_t *state, const uint32_t *m, uint8_t last){
+	uint32_t v[16];
+	uint8_t r, i, s, ab, cd;
+	uint32_t *a, *b, *c, *d;
+
+	memcpy_boot(v, state->h, 8*4);
+	blake2s_load_iv(v + 8);
+	v[12] ^= state->t;
+	if(last)
+		v[14] = ~v[14];
+
+	for(r=0; r<10; ++r){
+		for(i=0; i<8; ++i){
+			ab = pgm_read_byte(&blake2s_g[i][0]);
+			cd = pgm_read_byte(&blake2s_g[i][1]);
+			a = &v[ab >> 4]; b = &v[ab & 0x0F];
+			c = &v[cd >> 4]; d = &v[cd & 0x0F];
+			s = pgm_read_byte(&blake2s_sigma[r][2*i]);
+			*a += *b + m[s];
+			*d = rotr32(*d ^ *a, 16);
+			*c += *d;
+			*b = rotr32(*b ^ *c, 12);
+			s = pgm_read_byte(&blake2s_sigma[r][2*i+1]);
+			*a += *b + m[s];
+			*d = rotr32(*d ^ *a, 8);
+			*c += *d;
+			*b = rotr32(*b ^ *c, 7);
+		}
+	}
+
+	for(i=0; i<8; ++i){
+		state->h[i] ^= v[i] ^ v[i+8];
+	}
+}
+
+/*************************************************************************/
+
+BOOTLOADER_SECTION
+void blake2s_init(blake2s_ctx_t *state, const void *key, uint16_t keylength_b){
+	uint32_t m[16];
+
+	blake2s_load_iv(state->h);
+	/* parameter block: digest length, key length, fanout 1, depth 1 */
+	state->h[0] ^= 0x01010000 | ((uint32_t)(keylength_b/8) << 8) | BLAKE2S_HASH_BYTES;
+	state->t = 0;
+
+	if(keylength_b){
+		memzero_boot(m, sizeof(m));
+		memcpy_boot(m, key, keylength_b/8);
+		blake2s_nextBlock(state, m);
+		memzero_boot(m, sizeof(m));
+	}
+}
+
+BOOTLOADER_SECTION
+void blake2s_nextBlock(blake2s_ctx_t *state, const void *block){
+	uint32_t m[16];
+
+	memcpy_boot(m, block, BLAKE2S_BLOCK_BYTES);
+	state->t += BLAKE2S_BLOCK_BYTES;
+	blake2s_compress(state, m, 0);
+}
+
+BOOTLOADER_SECTION
+void blake2s_nextBlocks(blake2s_ctx_t *state, const void *block, uint8_t nblocks){
+	while(nblocks--){
+		blake2s_nextBlock(state, block);
+		block = (uint8_t*)block + BLAKE2S_BLOCK_BYTES;
+	}
+}
+
+/* Flash variants, the block is read with lpm */
+BOOTLOADER_SECTION
+void blake2s_nextBlock_P(blake2s_ctx_t *state, const void *block){
+	uint32_t m[16];
+	uint8_t i;
+
+	for(i=0; i<16; ++i){
+		m[i] = pgm_read_dword((uint8_t*)block + 4*i);
+	}
+	state->t += BLAKE2S_BLOCK_BYTES;
+	blake2s_compress(state, m, 0);
+}
+
+BOOTLOADER_SECTION
+void blake2s_nextBlocks_P(blake2s_ctx_t *state, const void *block, uint8_t nblocks){
+	while(nblocks--){
+		blake2s_nextBlock_P(state, block);
+		block = (uint8_t*)block + BLAKE2S_BLOCK_BYTES;
+	}
+}
+
+BOOTLOADER_SECTION
+void blake2s_lastBlock(blake2s_ctx_t *state, const void *block, uint16_t length_b){
+	uint32_t m[16];
+
+	/* keep at least one byte for the flagged block */
+	while(length_b > BLAKE2S_BLOCK_BITS){
+		blake2s_nextBlock(state, block);
+		length_b -= BLAKE2S_BLOCK_BITS;
+		block = (uint8_t*)block + BLAKE2S_BLOCK_BYTES;
+	}
+
+	memzero_boot(m, sizeof(m));
+	memcpy_boot(m, block, length_b/8);
+	state->t += length_b/8;
+	blake2s_compress(state, m, 1);
+}
+
+BOOTLOADER_SECTION
+void blake2s_ctx2hash(void *dest, const blake2s_ctx_t *state){
+	memcpy_boot(dest, state->h, BLAKE2S_HASH_BYTES);
+}
@@ -0,0 +1,80 @@
+/* blake2s.h */
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+ * \file	blake2s.h
+ * \license	GPLv3 or later
+ * \brief   BLAKE2s (RFC 7693) with a 256 bit digest, in the block interface
+ *          of the SHA cores (nextBlock/lastBlock/ctx2hash).
+ *
+ * Keyed BLAKE2s is a MAC on its own, no HMAC construction around it.
+ */
+
+#ifndef BLAKE2S_H_
+#define BLAKE2S_H_
+
+#include <stdint.h>
+
+#define BLAKE2S_HASH_BITS  256
+#define BLAKE2S_HASH_BYTES (BLAKE2S_HASH_BITS/8)
+#define BLAKE2S_BLOCK_BITS 512
+#define BLAKE2S_BLOCK_BYTES (BLAKE2S_BLOCK_BITS/8)
+#define BLAKE2S_KEY_BYTES  32
+
+/** \typedef blake2s_ctx_t
+ * \brief BLAKE2s context type
+ *
+ * h is the chain value, t the number of message bytes compressed so far
+ * (the high counter word is always zero on this target).
+ */
+typedef struct {
+	uint32_t h[8];
+	uint32_t t;
+} blake2s_ctx_t;
+
+/** \fn blake2s_init(blake2s_ctx_t *state, const void *key, uint16_t keylength_b)
+ * \brief initializes a BLAKE2s context, keyed if keylength_b is not zero
+ * The key (at most 256 bits) is compressed as the first block right away.
+ */
+void blake2s_init(blake2s_ctx_t *state, const void *key, uint16_t keylength_b);
+
+/** \fn blake2s_nextBlock(blake2s_ctx_t *state, const void *block)
+ * \brief processes one 64 byte block that is NOT the last one of the message
+ */
+void blake2s_nextBlock(blake2s_ctx_t *state, const void *block);
+void blake2s_nextBlocks(blake2s_ctx_t *state, const void *block, uint8_t nblocks);
+
+/** \fn blake2s_nextBlock_P(blake2s_ctx_t *state, const void *block)
+ * \brief as blake2s_nextBlock(), but block is a flash address
+ * Reads with lpm, from the microvisor section like the rest of the core.
+ */
+void blake2s_nextBlock_P(blake2s_ctx_t *state, const void *block);
+void blake2s_nextBlocks_P(blake2s_ctx_t *state, const void *block, uint8_t nblocks);
+
+/** \fn blake2s_lastBlock(blake2s_ctx_t *state, const void *block, uint16_t length_b)
+ * \brief processes the rest of the message and finalizes the context
+ * length_b must be a multiple of 8. BLAKE2s flags the last block instead of
+ * padding a length, so the final block holds 1..64 bytes here: a message
+ * that ends on a block boundary must keep its last block for this call.
+ * length_b may only be 0 for an unkeyed, empty message.
+ */
+void blake2s_lastBlock(blake2s_ctx_t *state, const void *block, uint16_t length_b);
+
+/** \fn blake2s_ctx2hash(void *dest, const blake2s_ctx_t *state)
+ * \brief writes the 32 byte digest of a finalized context to dest
+ */
+void blake2s_ctx2hash(void *dest, const blake2s_ctx_t *state);
+
+#endif /*BLAKE2S_H_*/
@@ -31,6 +31,7 @@
 #include <stdint.h>
 #include <string.h>
 #include <avr/boot.h>
+#include <avr/pgmspace.h>
 #include "sha1.h"
 #include "hmac-sha1.h"
 #include "string_boot.h"
@@ -46,7 +47,7 @@ void hmac_sha1_init(hmac_sha1_ctx_t *s, const void *key, uint16_t keylength_b){
 	uint8_t i;
 	
     /* Crucial change: key <= 160 bits */
-	memset(buffer, 0, SHA1_BLOCK_BYTES);
+	memzero_boot(buffer, SHA1_BLOCK_BYTES);
 	memcpy_boot(buffer, key, (keylength_b+7)/8);
 	
 	for (i=0; i<SHA1_BLOCK_BYTES; ++i){
@@ -63,7 +64,7 @@ void hmac_sha1_init(hmac_sha1_ctx_t *s, const void *key, uint16_t keylength_b){
 	
 	
 #if defined SECURE_WIPE_BUFFER
-	memset(buffer, 0, SHA1_BLOCK_BYTES);
+	memzero_boot(buffer, SHA1_BLOCK_BYTES);
 #endif
 }
 
@@ -71,6 +72,29 @@ BOOTLOADER_SECTION
 void hmac_sha1_nextBlock(hmac_sha1_ctx_t *s, const void *block){
 	sha1_nextBlock(&(s->a), block);
 }
+BOOTLOADER_SECTION
+void hmac_sha1_nextBlocks(hmac_sha1_ctx_t *s, const void *block, uint8_t nblocks){
+	while(nblocks--){
+		sha1_nextBlock(&(s->a), block);
+		block = (uint8_t*)block + SHA1_BLOCK_BYTES;
+	}
+}
+
+/* The SHA-1 core only reads RAM, so flash blocks go through a copy */
+BOOTLOADER_SECTION
+void hmac_sha1_nextBlocks_P(hmac_sha1_ctx_t *s, const void *block, uint8_t nblocks){
+	uint8_t buffer[SHA1_BLOCK_BYTES];
+	uint8_t i;
+
+	while(nblocks--){
+		for (i=0; i<SHA1_BLOCK_BYTES; ++i){
+			buffer[i] = pgm_read_byte_near((uint8_t*)block + i);
+		}
+		sha1_nextBlock(&(s->a), buffer);
+		block = (uint8_t*)block + SHA1_BLOCK_BYTES;
+	}
+}
+
 BOOTLOADER_SECTION
 void hmac_sha1_lastBlock(hmac_sha1_ctx_t *s, const void *block, uint16_t length_b){
 	while(length_b>=SHA1_BLOCK_BITS){
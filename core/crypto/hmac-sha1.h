@@ -32,6 +32,9 @@ typedef struct{
 
 void hmac_sha1_init(hmac_sha1_ctx_t *s, const void *key, uint16_t keylength_b);
 void hmac_sha1_nextBlock(hmac_sha1_ctx_t *s, const void *block);
+void hmac_sha1_nextBlocks(hmac_sha1_ctx_t *s, const void *block, uint8_t nblocks);
+/* block is a flash address */
+void hmac_sha1_nextBlocks_P(hmac_sha1_ctx_t *s, const void *block, uint8_t nblocks);
 void hmac_sha1_lastBlock(hmac_sha1_ctx_t *s, const void *block, uint16_t length_b);
 void hmac_sha1_final(void *dest, hmac_sha1_ctx_t *s);
 
@@ -30,24 +30,27 @@
 
 #include <stdint.h>
 #include <string.h>
+#include <avr/boot.h>
 #include "config.h"
 #include "sha256.h"
 #include "hmac-sha256.h"
+#include "string_boot.h"
 
 #define IPAD 0x36
 #define OPAD 0x5C
 
 #ifndef HMAC_SHA256_SHORTONLY
 
+BOOTLOADER_SECTION
 void hmac_sha256_init(hmac_sha256_ctx_t *s, const void *key, uint16_t keylength_b){
 	uint8_t buffer[HMAC_SHA256_BLOCK_BYTES];
 	uint8_t i;
 	
-	memset(buffer, 0, HMAC_SHA256_BLOCK_BYTES);
+	memzero_boot(buffer, HMAC_SHA256_BLOCK_BYTES);
 	if (keylength_b > HMAC_SHA256_BLOCK_BITS){
 		sha256((void*)buffer, key, keylength_b);
 	} else {
-		memcpy(buffer, key, (keylength_b+7)/8);
+		memcpy_boot(buffer, key, (keylength_b+7)/8);
 	}
 	
 	for (i=0; i<HMAC_SHA256_BLOCK_BYTES; ++i){
@@ -64,14 +67,21 @@ void hmac_sha256_init(hmac_sha256_ctx_t *s, const void *key, uint16_t keylength_
 	sha256_nextBlock(&(s->b), buffer);
 	
 #if defined SECURE_WIPE_BUFFER
-	memset(buffer, 0, SHA256_BLOCK_BYTES);
+	memzero_boot(buffer, SHA256_BLOCK_BYTES);
 #endif
 }
 
+BOOTLOADER_SECTION
 void hmac_sha256_nextBlock(hmac_sha256_ctx_t *s, const void *block){
 	sha256_nextBlock(&(s->a), block);
 }
 
+BOOTLOADER_SECTION
+void hmac_sha256_nextBlocks(hmac_sha256_ctx_t *s, const void *block, uint8_t nblocks){
+	sha256_nextBlocks(&(s->a), block, nblocks);
+}
+
+BOOTLOADER_SECTION
 void hmac_sha256_lastBlock(hmac_sha256_ctx_t *s, const void *block, uint16_t length_b){
 /*	while(length_b>=SHA256_BLOCK_BITS){
 		sha256_nextBlock(&(s->a), block);
@@ -81,30 +91,37 @@ void hmac_sha256_lastBlock(hmac_sha256_ctx_t *s, const void *block, uint16_t len
 */	sha256_lastBlock(&(s->a), block, length_b);
 }
 
+#ifndef HMAC_SHA256_FINAL_ASM
+BOOTLOADER_SECTION
 void hmac_sha256_final(void *dest, hmac_sha256_ctx_t *s){
 	sha256_ctx2hash((sha256_hash_t*)dest, &(s->a));
 	sha256_lastBlock(&(s->b), dest, SHA256_HASH_BITS);
 	sha256_ctx2hash((sha256_hash_t*)dest, &(s->b));			
 }
+#endif /* HMAC_SHA256_FINAL_ASM, see hmac-sha256-asm.S */
 
 #endif
 
+#ifdef HMAC_SHA256_ONESHOT
 /*
  * keylength in bits!
  * message length in bits!
+ * Nothing in the microvisor uses the one-shot, so it is only built on request
+ * and does not take boot section space.
  */
+BOOTLOADER_SECTION
 void hmac_sha256(void *dest, const void *key, uint16_t keylength_b, const void *msg, uint32_t msglength_b){ /* a one-shot*/
 	sha256_ctx_t s;
 	uint8_t i;
 	uint8_t buffer[HMAC_SHA256_BLOCK_BYTES];
 	
-	memset(buffer, 0, HMAC_SHA256_BLOCK_BYTES);
+	memzero_boot(buffer, HMAC_SHA256_BLOCK_BYTES);
 	
 	/* if key is larger than a block we have to hash it*/
 	if (keylength_b > SHA256_BLOCK_BITS){
 		sha256((void*)buffer, key, keylength_b);
 	} else {
-		memcpy(buffer, key, (keylength_b+7)/8);
+		memcpy_boot(buffer, key, (keylength_b+7)/8);
 	}
 	
 	for (i=0; i<SHA256_BLOCK_BYTES; ++i){
@@ -128,3 +145,4 @@ void hmac_sha256(void *dest, const void *key, uint16_t keylength_b, const void *
 	sha256_lastBlock(&s, dest, SHA256_HASH_BITS);
 	sha256_ctx2hash(dest, &s);
 }
+#endif
@@ -34,6 +34,14 @@ typedef struct {
 
 void hmac_sha256_init(hmac_sha256_ctx_t *s, const void *key, uint16_t keylength_b);
 void hmac_sha256_nextBlock(hmac_sha256_ctx_t *s, const void *block);
+void hmac_sha256_nextBlocks(hmac_sha256_ctx_t *s, const void *block, uint8_t nblocks);
+/* block is a flash address, see sha256_nextBlock_P() */
+static inline void hmac_sha256_nextBlock_P(hmac_sha256_ctx_t *s, const void *block){
+	sha256_nextBlock_P(&(s->a), block);
+}
+static inline void hmac_sha256_nextBlocks_P(hmac_sha256_ctx_t *s, const void *block, uint8_t nblocks){
+	sha256_nextBlocks_P(&(s->a), block, nblocks);
+}
 void hmac_sha256_lastBlock(hmac_sha256_ctx_t *s, const void *block, uint16_t length_b);
 void hmac_sha256_final(void *dest, hmac_sha256_ctx_t *s);
 
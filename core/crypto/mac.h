@@ -0,0 +1,117 @@
+/* mac.h */
+/*
+ * MAC engine used by the microvisor for image verification and attestation,
+ * selected per build with one of
+ *   MAC_SHA256   HMAC-SHA256, 32 byte tag (default)
+ *   MAC_SHA1     HMAC-SHA1, 20 byte tag
+ *   MAC_BLAKE2S  keyed BLAKE2s-256, 32 byte tag
+ * (see MAC in core/Makefile.include). All engines take 64 byte blocks, so
+ * page and block bookkeeping does not depend on the choice; only the tag
+ * length MAC_BYTES does.
+ *
+ * The interface follows the HMAC modules: mac_init, mac_nextBlock(s),
+ * mac_nextBlocks_P (block is a flash address), mac_lastBlock (length in bits,
+ * must not be 0) and mac_final. Only keyed tags go through it: image and page
+ * list MACs, attestation responses. Plain digests (the full-flash digest under
+ * the attestation MAC, the ATT_MERKLE tree, sample seeds, page list hashes)
+ * stay SHA-256 whatever the MAC, and ATT_BOOT_FIRST needs MAC_SHA256.
+ *
+ * License: GPLv3 or later
+ */
+#ifndef MAC_H_
+#define MAC_H_
+
+#if !defined MAC_SHA1 && !defined MAC_BLAKE2S && !defined MAC_SHA256
+#define MAC_SHA256
+#endif
+
+#if defined MAC_SHA256
+
+#include "hmac-sha256.h"
+
+#define MAC_BYTES       HMAC_SHA256_BYTES
+#define MAC_BLOCK_BYTES HMAC_SHA256_BLOCK_BYTES
+
+typedef hmac_sha256_ctx_t mac_ctx_t;
+
+static inline void mac_init(mac_ctx_t *s, const void *key, uint16_t keylength_b){
+	hmac_sha256_init(s, key, keylength_b);
+}
+static inline void mac_nextBlock(mac_ctx_t *s, const void *block){
+	hmac_sha256_nextBlock(s, block);
+}
+static inline void mac_nextBlocks(mac_ctx_t *s, const void *block, uint8_t nblocks){
+	hmac_sha256_nextBlocks(s, block, nblocks);
+}
+static inline void mac_nextBlocks_P(mac_ctx_t *s, const void *block, uint8_t nblocks){
+	hmac_sha256_nextBlocks_P(s, block, nblocks);
+}
+static inline void mac_lastBlock(mac_ctx_t *s, const void *block, uint16_t length_b){
+	hmac_sha256_lastBlock(s, block, length_b);
+}
+static inline void mac_final(void *dest, mac_ctx_t *s){
+	hmac_sha256_final(dest, s);
+}
+
+#elif defined MAC_SHA1
+
+#include "hmac-sha1.h"
+
+#define MAC_BYTES       HMAC_SHA1_BYTES
+#define MAC_BLOCK_BYTES HMAC_SHA1_BLOCK_BYTES
+
+typedef hmac_sha1_ctx_t mac_ctx_t;
+
+static inline void mac_init(mac_ctx_t *s, const void *key, uint16_t keylength_b){
+	hmac_sha1_init(s, key, keylength_b);
+}
+static inline void mac_nextBlock(mac_ctx_t *s, const void *block){
+	hmac_sha1_nextBlock(s, block);
+}
+static inline void mac_nextBlocks(mac_ctx_t *s, const void *block, uint8_t nblocks){
+	hmac_sha1_nextBlocks(s, block, nblocks);
+}
+static inline void mac_nextBlocks_P(mac_ctx_t *s, const void *block, uint8_t nblocks){
+	hmac_sha1_nextBlocks_P(s, block, nblocks);
+}
+static inline void mac_lastBlock(mac_ctx_t *s, const void *block, uint16_t length_b){
+	hmac_sha1_lastBlock(s, block, length_b);
+}
+static inline void mac_final(void *dest, mac_ctx_t *s){
+	hmac_sha1_final(dest, s);
+}
+
+#elif defined MAC_BLAKE2S
+
+#include "blake2s.h"
+
+#define MAC_BYTES       BLAKE2S_HASH_BYTES
+#define MAC_BLOCK_BYTES BLAKE2S_BLOCK_BYTES
+
+typedef blake2s_ctx_t mac_ctx_t;
+
+static inline void mac_init(mac_ctx_t *s, const void *key, uint16_t keylength_b){
+	blake2s_init(s, key, keylength_b);
+}
+static inline void mac_nextBlock(mac_ctx_t *s, const void *block){
+	blake2s_nextBlock(s, block);
+}
+static inline void mac_nextBlocks(mac_ctx_t *s, const void *block, uint8_t nblocks){
+	blake2s_nextBlocks(s, block, nblocks);
+}
+static inline void mac_nextBlocks_P(mac_ctx_t *s, const void *block, uint8_t nblocks){
+	blake2s_nextBlocks_P(s, block, nblocks);
+}
+static inline void mac_lastBlock(mac_ctx_t *s, const void *block, uint16_t length_b){
+	blake2s_lastBlock(s, block, length_b);
+}
+static inline void mac_final(void *dest, mac_ctx_t *s){
+	blake2s_ctx2hash(dest, s);
+}
+
+#endif
+
+#define MAC_BITS       (MAC_BYTES*8)
+#define MAC_BLOCK_BITS (MAC_BLOCK_BYTES*8)
+
+#endif /*MAC_H_*/
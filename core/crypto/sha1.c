@@ -29,6 +29,7 @@
 #include <stdint.h>
 #include <avr/boot.h>
 #include "sha1.h"
+#include "string_boot.h"
 
 #define LITTLE_ENDIAN
 
@@ -106,7 +107,7 @@ void sha1_nextBlock (sha1_ctx_t *state, const void *block){
 	}
 
 	/* load the state */
-	memcpy(a, state->h, 5*sizeof(uint32_t));
+	memcpy_boot(a, state->h, 5*sizeof(uint32_t));
 
 
 	/* the fun stuff */
@@ -147,8 +148,8 @@ void sha1_lastBlock(sha1_ctx_t *state, const void *block, uint16_t length){
 		block = (uint8_t*)block + SHA1_BLOCK_BYTES;
 	}
 	state->length += length;
-	memset(lb, 0, SHA1_BLOCK_BYTES);
-	memcpy (lb, block, (length+7)>>3);
+	memzero_boot(lb, SHA1_BLOCK_BYTES);
+	memcpy_boot(lb, block, (length+7)>>3);
 
 	/* set the final one bit */
 	lb[length>>3] |= 0x80>>(length & 0x07);
@@ -156,7 +157,7 @@ void sha1_lastBlock(sha1_ctx_t *state, const void *block, uint16_t length){
 	if (length>512-64-1){ /* not enouth space for 64bit length value */
 		sha1_nextBlock(state, lb);
 		state->length -= 512;
-		memset(lb, 0, SHA1_BLOCK_BYTES);
+		memzero_boot(lb, SHA1_BLOCK_BYTES);
 	}
 	/* store the 64bit length value */
 #if defined LITTLE_ENDIAN
@@ -182,7 +183,7 @@ void sha1_ctx2hash (void *dest, sha1_ctx_t *state){
 	}
 #elif BIG_ENDIAN
 	if (dest != state->h)
-		memcpy(dest, state->h, SHA1_HASH_BITS/8);
+		memcpy_boot(dest, state->h, SHA1_HASH_BITS/8);
 #else
 # error unsupported endian type!
 #endif
@@ -31,7 +31,21 @@
 
 #include <stdint.h>
 #include <string.h> /* for memcpy, memmove, memset */
+#include <avr/boot.h>
+#include <avr/pgmspace.h>
+#include "bootloader_progmem.h"
 #include "sha256.h"
+#include "string_boot.h"
+
+/*
+ * SRAM-lean variant: the round constants and the initial vector stay in flash
+ * (PROGMEM), the message schedule is a rolling window of 16 words instead of
+ * w[64], and the working variables rotate through named locals instead of
+ * memmove() on a[8]. Stack per compression is the 64 byte window plus the
+ * locals, against 256 + 32 bytes before. Select it with SHA256_CORE in
+ * core/Makefile.include. Code and tables live in the microvisor section like
+ * sha256-asm.S, and only call the string_boot.h helpers.
+ */
 
 #define LITTLE_ENDIAN
 
@@ -44,7 +58,7 @@
 
 /*************************************************************************/
 
-uint32_t sha256_init_vector[]={
+BOOTLOADER_PROGMEM static const uint32_t sha256_init_vector[] = {
 	0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
     0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19 };
 
@@ -57,9 +71,14 @@ uint32_t sha256_init_vector[]={
  * @param state pointer to a sha256 context
  * @return none
  */
+BOOTLOADER_SECTION
 void sha256_init(sha256_ctx_t *state){
+	uint8_t i;
+
 	state->length=0;
-	memcpy(state->h, sha256_init_vector, 8*4);
+	for (i=0; i<8; ++i){
+		state->h[i] = pgm_read_dword(&sha256_init_vector[i]);
+	}
 }
 
 /*************************************************************************/
@@ -67,6 +86,7 @@ void sha256_init(sha256_ctx_t *state){
 /**
  * rotate x right by n positions
  */
+BOOTLOADER_SECTION
 uint32_t rotr32( uint32_t x, uint8_t n){
 	return ((x>>n) | (x<<(32-n)));
 }
@@ -76,6 +96,7 @@ uint32_t rotr32( uint32_t x, uint8_t n){
 
 // #define CHANGE_ENDIAN32(x) (((x)<<24) | ((x)>>24) | (((x)& 0x0000ff00)<<8) | (((x)& 0x00ff0000)>>8))
 
+BOOTLOADER_SECTION
 uint32_t change_endian32(uint32_t x){
 	return (((x)<<24) | ((x)>>24) | (((x)& 0x0000ff00)<<8) | (((x)& 0x00ff0000)>>8));
 }
@@ -94,7 +115,7 @@ uint32_t change_endian32(uint32_t x){
 #define SIGMA_b(x) (rotr32((x),17) ^ rotr32((x),19) ^ ((x)>>10))
 
 
-uint32_t k[]={
+BOOTLOADER_PROGMEM static const uint32_t k[] = {
 	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
 	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
 	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
@@ -108,13 +129,44 @@ uint32_t k[]={
 
 /*************************************************************************/
 
+/**
+ * compresses the 16 message words in w (host order, overwritten by the
+ * schedule) into state
+ */
+BOOTLOADER_SECTION
+static void sha256_compress(sha256_ctx_t *state, uint32_t *w){
+	uint8_t  i;
+	uint32_t a,b,c,d,e,f,g,h,t1,t2;
+
+	/* init working variables */
+	a = state->h[0]; b = state->h[1]; c = state->h[2]; d = state->h[3];
+	e = state->h[4]; f = state->h[5]; g = state->h[6]; h = state->h[7];
+
+	/* do the, fun stuff, */
+	for (i=0; i<64; ++i){
+		if (i >= 16){
+			/* w[i] over w[i-16], both are i&15 in the window */
+			w[i&15] += SIGMA_b(w[(i-2)&15]) + w[(i-7)&15] + SIGMA_a(w[(i-15)&15]);
+		}
+		t1 = h + SIGMA1(e) + CH(e,f,g) + pgm_read_dword(&k[i]) + w[i&15];
+		t2 = SIGMA0(a) + MAJ(a,b,c);
+		h = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+
+	/* update, the, state, */
+	state->h[0] += a; state->h[1] += b; state->h[2] += c; state->h[3] += d;
+	state->h[4] += e; state->h[5] += f; state->h[6] += g; state->h[7] += h;
+	state->length += 512;
+}
+
 /**
  * block must be, 512, Bit = 64, Byte, long !!!
  */
+BOOTLOADER_SECTION
 void sha256_nextBlock (sha256_ctx_t *state, const void *block){
-	uint32_t w[64];	/* this is 256, byte, large, */
+	uint32_t w[16];
 	uint8_t  i;
-	uint32_t a[8],t1,t2;
 
 	/* init w */
 #if defined LITTLE_ENDIAN
@@ -122,29 +174,37 @@ void sha256_nextBlock (sha256_ctx_t *state, const void *block){
 			w[i]= change_endian32(((uint32_t*)block)[i]);
 		}
 #elif defined BIG_ENDIAN
-		memcpy((void*)w, block, 64);
+		memcpy_boot((void*)w, block, 64);
 #endif
-		for (i=16; i<64; ++i){
-			w[i] = SIGMA_b(w[i-2]) + w[i-7] + SIGMA_a(w[i-15]) + w[i-16];
-		}
+	sha256_compress(state, w);
+}
 
-	/* init working variables */
-		memcpy((void*)a,(void*)(state->h), 8*4);
+BOOTLOADER_SECTION
+void sha256_nextBlocks (sha256_ctx_t *state, const void *block, uint8_t nblocks){
+	while(nblocks--){
+		sha256_nextBlock(state, block);
+		block = (uint8_t*)block + SHA256_BLOCK_BYTES;
+	}
+}
 
-	/* do the, fun stuff, */
-		for (i=0; i<64; ++i){
-			t1 = a[7] + SIGMA1(a[4]) + CH(a[4],a[5],a[6]) + k[i] + w[i];
-			t2 = SIGMA0(a[0]) + MAJ(a[0],a[1],a[2]);
-			memmove(&(a[1]), &(a[0]), 7*4); 	/* a[7]=a[6]; a[6]=a[5]; a[5]=a[4]; a[4]=a[3]; a[3]=a[2]; a[2]=a[1]; a[1]=a[0]; */
-			a[4] += t1;
-			a[0] = t1 + t2;
-		}
+/* Flash variants, the block is read with lpm */
+BOOTLOADER_SECTION
+void sha256_nextBlock_P (sha256_ctx_t *state, const void *block){
+	uint32_t w[16];
+	uint8_t  i;
 
-	/* update, the, state, */
-		for (i=0; i<8; ++i){
-			state->h[i] += a[i];
-		}
-		state->length += 512;
+	for (i=0; i<16; ++i){
+		w[i]= change_endian32(pgm_read_dword((uint8_t*)block + 4*i));
+	}
+	sha256_compress(state, w);
+}
+
+BOOTLOADER_SECTION
+void sha256_nextBlocks_P (sha256_ctx_t *state, const void *block, uint8_t nblocks){
+	while(nblocks--){
+		sha256_nextBlock_P(state, block);
+		block = (uint8_t*)block + SHA256_BLOCK_BYTES;
+	}
 }
 
 
@@ -158,6 +218,7 @@ void sha256_nextBlock (sha256_ctx_t *state, const void *block){
  *  bits are big endian, meaning high bits come first.
  * 	if you have a message with bits at the end, the byte must be padded with zeros
  */
+BOOTLOADER_SECTION
 void sha256_lastBlock(sha256_ctx_t *state, const void *block, uint16_t length){
 	uint8_t lb[SHA256_BLOCK_BITS/8]; /* local block */
 	while(length>=SHA256_BLOCK_BITS){
@@ -167,7 +228,7 @@ void sha256_lastBlock(sha256_ctx_t *state, const void *block, uint16_t length){
 	}
 
 	state->length += length;
-	memcpy (&(lb[0]), block, length/8);
+	memcpy_boot(&(lb[0]), block, length/8);
 
 	/* set the final one bit */
 	if (length & 0x7){ // if we have single bits at the end
@@ -179,12 +240,12 @@ void sha256_lastBlock(sha256_ctx_t *state, const void *block, uint16_t length){
 	length =(length >> 3) + 1; /* from now on length contains the number of BYTES in lb*/
 	/* pad with zeros */
 	if (length>64-8){ /* not enouth space for 64bit length value */
-		memset((void*)(&(lb[length])), 0, 64-length);
+		memzero_boot((void*)(&(lb[length])), 64-length);
 		sha256_nextBlock(state, lb);
 		state->length -= 512;
 		length = 0;
 	}
-	memset((void*)(&(lb[length])), 0, 56-length);
+	memzero_boot((void*)(&(lb[length])), 56-length);
 	/* store the 64bit length value */
 #if defined LITTLE_ENDIAN
 	 	/* this is now rolled up */
@@ -204,6 +265,7 @@ void sha256_lastBlock(sha256_ctx_t *state, const void *block, uint16_t length){
 /*
  * length in bits!
  */
+BOOTLOADER_SECTION
 void sha256(sha256_hash_t *dest, const void *msg, uint32_t length){ /* length could be choosen longer but this is for µC */
 	sha256_ctx_t s;
 	sha256_init(&s);
@@ -220,6 +282,7 @@ void sha256(sha256_hash_t *dest, const void *msg, uint32_t length){ /* length co
 
 /*************************************************************************/
 
+BOOTLOADER_SECTION
 void sha256_ctx2hash(sha256_hash_t *dest, const sha256_ctx_t *state){
 #if defined LITTLE_ENDIAN
 	uint8_t i;
@@ -228,7 +291,7 @@ void sha256_ctx2hash(sha256_hash_t *dest, const sha256_ctx_t *state){
 	}
 #elif BIG_ENDIAN
 	if (dest != state->h)
-		memcpy(dest, state->h, SHA256_HASH_BITS/8);
+		memcpy_boot(dest, state->h, SHA256_HASH_BITS/8);
 #else
 # error unsupported endian type!
 #endif
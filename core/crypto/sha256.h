@@ -89,6 +89,38 @@ void sha256_init(sha256_ctx_t *state);
  */
 void sha256_nextBlock (sha256_ctx_t *state, const void *block);
 
+/** \fn void sha256_nextBlocks (sha256_ctx_t *state, const void *block, uint8_t nblocks)
+ * \brief update the context with several consecutive blocks
+ * 
+ * Same as calling sha256_nextBlock() nblocks times on consecutive blocks.
+ * Registers are saved and the frame is set up once per call; whether that
+ * is measurably faster has not been timed (see apps/crypto_bench).
+ * \param state pointer to the SHA-256 hash context
+ * \param block pointer to the first block (512 bit = 64 byte)
+ * \param nblocks number of blocks, 0 does nothing
+ */
+void sha256_nextBlocks (sha256_ctx_t *state, const void *block, uint8_t nblocks);
+
+/** \fn void sha256_nextBlock_P (sha256_ctx_t *state, const void *block)
+ * \brief update the context with a block stored in flash
+ * 
+ * Same as sha256_nextBlock(), but block is a flash (progmem) byte address and
+ * is read with lpm directly, without copying it to SRAM first. Like the rest
+ * of the core it lives in the microvisor section, only the microvisor calls
+ * it.
+ * \param state pointer to the SHA-256 hash context
+ * \param block flash address of the block of fixed length (512 bit = 64 byte)
+ */
+void sha256_nextBlock_P (sha256_ctx_t *state, const void *block);
+
+/** \fn void sha256_nextBlocks_P (sha256_ctx_t *state, const void *block, uint8_t nblocks)
+ * \brief sha256_nextBlocks() for consecutive blocks in flash
+ * \param state pointer to the SHA-256 hash context
+ * \param block flash address of the first block (512 bit = 64 byte)
+ * \param nblocks number of blocks, 0 does nothing
+ */
+void sha256_nextBlocks_P (sha256_ctx_t *state, const void *block, uint8_t nblocks);
+
 /** \fn void sha256_lastBlock(sha256_ctx_t *state, const void *block, uint16_t length_b)
  * \brief finalize the context with the given block 
  * 
@@ -4,5 +4,9 @@
 /* Identical copy of memcpy, just located in the bootloader section. */
 void *memcpy_boot(void *, const void *, size_t);
 int memcmp_boot(const void *, const void *, size_t);
+/* memset to 0 that is never optimized away, for key material */
+void memzero_boot(void *, size_t);
+/* Zeroes n bytes of the stack below the caller's frame */
+void stack_wipe_boot(size_t);
 
 #endif /*MEMCPY_H_*/
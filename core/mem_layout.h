@@ -67,4 +67,17 @@
 #define MEM_END 0x7FFF
 #define MEM_ENDW 0x4000
 
+/* Last 32 bytes of flash (.bootmid): SHA-256 state after the immutable
+ * microvisor region, see ATT_BOOT_FIRST */
+#define BOOT_MIDSTATE 0x7FE0
+
+/* EEPROM layout (byte addresses). The app can write EEPROM as well, so
+ * nothing here is secret or trusted beyond what the verifier checks. */
+#define EE_ATT_COUNTER 0x000 // uint32_t, self-attestation counter
+#define EE_ATT_EPOCH 0x004   // 16 bytes, verifier epoch
+#define EE_LOAD_MAC 0x014    // 32 bytes, MAC of the image loading into SHADOW
+#define EE_LOAD_PAGES 0x034  // 7 bytes, bit i: page i of it is in SHADOW
+#define EE_PAGE_LIST 0x040   // 440 bytes, page list of the image in SHADOW
+#define EE_END 0x3FF
+
 #endif
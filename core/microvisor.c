@@ -1,14 +1,15 @@
 #include "microvisor.h"
 #include "virt_i.h"
 #include <avr/boot.h>
+#include <avr/eeprom.h>
 #include <avr/io.h>
 #include <avr/pgmspace.h>
 #include <avr/interrupt.h>
 #include <string.h>
 #include "bootloader_progmem.h"
 #include "mem_layout.h"
-// #include "hmac-sha1.h"
-#include "hmac-sha256.h"
+#include "mac.h"
+#include "sha256.h"
 #include "string_boot.h"
 
 /* Sets some ELF metadata (not strictly required) */
@@ -31,26 +32,201 @@ const uint16_t uvisor_entrypoints[] = {
     (uint16_t) &safe_icall_ijmp,
     (uint16_t) &safe_ret,
     (uint16_t) &safe_reti,
+    (uint16_t) &copy_data,
     (uint16_t) &load_image,
+#ifdef OTA_DELTA
+    (uint16_t) &load_image_copy,
+#endif
+#ifdef OTA_LZ
+    (uint16_t) &load_image_lz,
+#endif
+    (uint16_t) &load_rx,
+    (uint16_t) &load_progress,
+#ifdef OTA_PAGE_LIST
+    (uint16_t) &load_page_list,
+#endif
     (uint16_t) &verify_activate_image,
     (uint16_t) &parse_att_msg,
+#ifdef OTA_BROADCAST
+    (uint16_t) &parse_ota_msg,
+#endif
     (uint16_t) &device_auth,
     (uint16_t) &map_init,
+#ifdef ATT_SLICED
+    (uint16_t) &att_start,
+    (uint16_t) &att_step,
+    (uint16_t) &att_finish,
+#endif
+#ifdef ATT_BATCH
+    (uint16_t) &att_resp_batch,
+#endif
+    (uint16_t) &att_init,
+#ifdef ATT_SELF
+    (uint16_t) &att_self,
+#endif
+#ifdef ATT_MEASURE
+    (uint16_t) &att_measure,
+#endif
     0x0000
 };
 
- BOOTLOADER_PROGMEM static const uint8_t key_hmac[] = {0x6e, 0x26, 0x88, 0x6e,
+/* Device key of the MAC engine (core/crypto/mac.h). With MAC_SHA256 it is not
+ * read at runtime: hex_patch_bootmem.py takes it from the image to fill in
+ * key_hmac_mid. */
+ BOOTLOADER_PROGMEM __attribute__((used)) static const uint8_t key_hmac[] = {0x6e, 0x26, 0x88, 0x6e,
     0x4e, 0x07, 0x07, 0xe1, 0xb3, 0x0f, 0x24, 0x16, 0x0e, 0x99, 0xb9, 0x12,
     0xe4, 0x61, 0xc4, 0x24, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
     0x01, 0x01, 0x01};
 
+#ifdef MAC_SHA256
+/* HMAC-SHA256 midstates for key_hmac: SHA-256 state (h0..h7, little endian
+ * words as in sha256_ctx_t) after compressing key^ipad, then after key^opad.
+ * Zero here, patched into the hex by core/scripts/hex_patch_bootmem.py. */
+BOOTLOADER_PROGMEM static const uint8_t key_hmac_mid[2*SHA256_HASH_BYTES] = {0};
+
+/* SHA-256 state (h0..h7) after the microvisor region MICROVISOR..MEM_END,
+ * with these 32 bytes still zero. Unkeyed. Patched into the hex by
+ * hex_patch_bootmem.py, lives at BOOT_MIDSTATE. */
+__attribute__((section(".bootmid"), used))
+static const uint8_t boot_hmac_mid[SHA256_HASH_BYTES] = {0};
+#endif
+
 // BOOTLOADER_PROGMEM uint8_t metadata[HASH_MAP_SIZE] = {0};
 // BOOTLOADER_PROGMEM uint16_t prover_id_map[HASH_MAP_SIZE] = {0};
-// BOOTLOADER_PROGMEM uint8_t prev_mem_state[32] = {0};
 // BOOTLOADER_SECTION uint16_t self_id = 1000;
 
-// BOOTLOADER_PROGMEM uint8_t mem_changed = 1;
 
+#ifdef ATT_MERKLE
+/* Digest tree over all of flash. leaf[i] is the SHA-256 of pages
+ * [i*ATT_LEAF_PAGES, (i+1)*ATT_LEAF_PAGES), root is the SHA-256 over all leaf
+ * digests. A set bit in dirty means the leaf (and thus the root) is stale.
+ * .bootbss is open to the app and not cleared at reset, so the root is only
+ * trusted when magic matches and tag, the MAC over it, checks out; clean
+ * leaves only when they still hash to that root (att_tree_update()). The app
+ * can put back a tree it saw earlier, which only hides pages it had written
+ * to SHADOW itself since; att_init() drops the tree after a reset. */
+#define ATT_TREE_MAGIC 0xA7E5
+
+typedef struct {
+  uint16_t magic;
+  uint8_t dirty[(ATT_LEAVES + 7)/8];
+  uint8_t leaf[ATT_LEAVES][SHA256_HASH_BYTES];
+  uint8_t root[SHA256_HASH_BYTES];
+  uint8_t tag[MAC_BYTES];
+} att_tree_t;
+
+BOOTLOADER_BSS static att_tree_t att_tree;
+#else
+/* Cached memory state for att_resp(). Valid while magic matches, write_page()
+ * clears it so the next request rescans. */
+#define ATT_STATE_MAGIC 0xA75A
+
+typedef struct {
+  uint16_t magic;
+  uint8_t digest[32];
+} att_state_t;
+
+BOOTLOADER_BSS static att_state_t att_state;
+#endif
+
+/* Time-sliced attestation (att_start/att_step/att_finish). .bootbss is open
+ * to the app, so no key material is kept between steps: ctx is the plain
+ * SHA-256 state of the memory digest, which att_finish() MACs together with
+ * the nonce. erased collects the erased map (ATT_SKIP_ERASED), hashed after
+ * the pages. tag is the MAC over everything from page on; every call checks
+ * it and renews it, so the app can neither plant the state of another
+ * memory image nor move the cursor. magic is only set while a scan is in
+ * progress. */
+#define ATT_SCAN_MAGIC 0x5CA7
+#ifdef ATT_BOOT_FIRST
+#define ATT_SCAN_PAGES (MICROVISOR/PAGE_SIZE)
+#else
+#define ATT_SCAN_PAGES MEM_PAGES
+#endif
+
+typedef struct {
+  uint16_t magic;
+  uint8_t page;
+  uint8_t block;
+  sha256_ctx_t ctx;
+#ifdef ATT_SKIP_ERASED
+  uint8_t erased[ATT_ERASED_MAP_SIZE];
+#endif
+  uint8_t nonce[20];
+#ifdef ATT_SLICED
+  uint8_t tag[MAC_BYTES];
+#endif
+} att_scan_t;
+
+BOOTLOADER_BSS static att_scan_t att_scan;
+
+/* Receive ring handed out by load_rx(). The load functions keep interrupts
+ * off for milliseconds while the flash is programmed, longer than the UART
+ * buffers bytes; they move received bytes into the ring themselves while
+ * they wait on SPM. The ring is only filled while magic is set. Its storage
+ * is fixed here, so the app cannot point those writes elsewhere (the
+ * microvisor stack, switch_image() buffers). */
+#define LOAD_RX_MAGIC 0x52A7
+
+#if LOAD_RX_SIZE & (LOAD_RX_SIZE - 1) || LOAD_RX_SIZE > 256
+#error "LOAD_RX_SIZE must be a power of 2, at most 256!"
+#endif
+
+typedef struct {
+  uint16_t magic;
+  load_rx_ring_t ring;
+} load_rx_t;
+
+BOOTLOADER_BSS static load_rx_t load_rx_state;
+
+#ifdef ATT_MEASURE
+/* Self-measurement history (att_measure()), oldest entry at
+ * (head - count) mod ATT_HISTORY. Each entry carries its own MAC, so the app
+ * can drop entries but not forge them. */
+#define ATT_HISTORY_MAGIC 0xA7B1
+
+typedef struct {
+  uint32_t time;
+  uint8_t mac[MAC_BYTES];
+} att_entry_t;
+
+typedef struct {
+  uint16_t magic;
+  uint8_t head;
+  uint8_t count;
+  att_entry_t entry[ATT_HISTORY];
+} att_history_t;
+
+BOOTLOADER_BSS static att_history_t att_history;
+
+#endif
+#ifdef OTA_BROADCAST
+/* Broadcast OTA page being put together from ota_chunk messages in the
+ * app's page buffer (parse_ota_msg()) */
+#define OTA_RX_MAGIC 0x0BCA
+
+typedef struct {
+  uint16_t magic;
+  uint8_t tag[OTA_TAG_BYTES];
+  uint8_t page;
+  uint8_t chunks;         /* bit i: chunk i is in the buffer */
+} ota_rx_t;
+
+BOOTLOADER_BSS static ota_rx_t ota_rx;
+
+#endif
+#ifdef OTA_PAGE_LIST
+/* Page list of the image in SHADOW (load_page_list()) is in EEPROM and its
+ * MAC checked out. Loading a header drops it. */
+#define PAGE_LIST_MAGIC 0x71A5
+
+typedef struct {
+  uint16_t magic;
+} page_list_t;
+
+BOOTLOADER_BSS static page_list_t page_list;
+
+#endif
 /****************************************************************************/
 /*                      MICROVISOR HELPER FUNCTIONS                         */
 /****************************************************************************/
@@ -99,15 +275,130 @@ verify_target_deploy(uint16_t target) {
   }
 }
 
-/* Writes to arbitrary page of progmem */
+#ifdef ATT_MERKLE
+/* Marks the tree leaf covering byte address offset as stale */
+BOOTLOADER_SECTION static inline void
+att_tree_invalidate(uint32_t offset) {
+  uint8_t leaf;
+
+#ifdef ATT_SKIP_ERASED
+  /* Image size in a metadata header decides which pages may be elided, so a
+   * header write can change the digest of leaves that were not written */
+  if(offset == APP_META || offset == SHADOW_META) {
+    for(leaf=0; leaf<sizeof(att_tree.dirty); leaf++)
+      att_tree.dirty[leaf] = 0xFF;
+    return;
+  }
+#endif
+
+  leaf = offset / ((uint32_t) PAGE_SIZE * ATT_LEAF_PAGES);
+  att_tree.dirty[leaf >> 3] |= 1 << (leaf & 0x07);
+}
+#endif
+
+/* Moves a received byte, if any, into the receive ring. A byte that finds
+ * the ring full is dropped, the transfer protocol has to notice. head is
+ * masked again: the app can write it. */
+BOOTLOADER_SECTION static void
+load_rx_poll() {
+  load_rx_ring_t *ring = &load_rx_state.ring;
+  uint8_t head;
+
+  if(load_rx_state.magic != LOAD_RX_MAGIC || !(UCSR0A & _BV(RXC0)))
+    return;
+
+  head = ring->head & (LOAD_RX_SIZE - 1);
+  ring->buf[head] = UDR0;
+  head = (head + 1) & (LOAD_RX_SIZE - 1);
+  if(head != ring->tail)
+    ring->head = head;
+}
+
+/* boot_spm_busy_wait() that keeps up with the UART */
+BOOTLOADER_SECTION static void
+spm_busy_wait() {
+  while(boot_spm_busy())
+    load_rx_poll();
+}
+
+/* Empties the UART receive FIFO (two bytes) between steps that take longer
+ * than a byte time, so nothing is overrun while interrupts are off */
+BOOTLOADER_SECTION static void
+load_rx_drain() {
+  load_rx_poll();
+  load_rx_poll();
+}
+
+/* An EEPROM write blocks SPM and takes ~3.4 ms: wait for it the same way */
+BOOTLOADER_SECTION static void
+ee_busy_wait() {
+  while(!eeprom_is_ready())
+    load_rx_poll();
+}
+
+/* EEPROM access through the registers, not the avr-libc routines: those are
+ * linked into app .text, where verify_shadow() refuses their ret */
+BOOTLOADER_SECTION static uint8_t
+ee_read(uint16_t addr) {
+  ee_busy_wait();
+  EEAR = addr;
+  EECR |= _BV(EERE);
+  return EEDR;
+}
+
+/* Interrupts are off in the microvisor, so EEPE follows EEMPE within the
+ * four cycles the hardware allows */
+BOOTLOADER_SECTION static void
+ee_update(uint16_t addr, uint8_t value) {
+  if(ee_read(addr) == value)
+    return;
+  EEDR = value;
+  EECR = _BV(EEMPE);
+  EECR |= _BV(EEPE);
+}
+
+BOOTLOADER_SECTION static void
+ee_read_block(void *dest, uint16_t addr, uint8_t n) {
+  for(uint8_t i = 0; i < n; i++)
+    ((uint8_t*) dest)[i] = ee_read(addr + i);
+}
+
+BOOTLOADER_SECTION static void
+ee_update_block(const void *src, uint16_t addr, uint8_t n) {
+  for(uint8_t i = 0; i < n; i++)
+    ee_update(addr + i, ((const uint8_t*) src)[i]);
+}
+
+/* Writes to arbitrary page of progmem. A page that already holds page_buf is
+ * left alone: no erase/program cycle (wear, ~4 ms) and the attestation
+ * caches stay valid. */
 BOOTLOADER_SECTION static void
 write_page(uint8_t *page_buf, uint32_t offset) {
   uint32_t pageptr;
+  uint16_t j;
   uint8_t i;
 
+  if(!(offset % PAGE_SIZE)) {
+    for(j=0; j<PAGE_SIZE; j++)
+      if(pgm_read_byte_near(offset + j) != page_buf[j])
+        break;
+    if(j == PAGE_SIZE)
+      return;
+  }
+
+#ifdef ATT_MERKLE
+  att_tree_invalidate(offset);
+#else
+  att_state.magic = 0;
+#endif
+  /* A scan in progress would MAC a mix of old and new flash */
+  att_scan.magic = 0;
+
+  ee_busy_wait();
+
   /* Erase page */
   boot_page_erase(offset);
-  boot_spm_busy_wait();
+  spm_busy_wait();
 
   /* Write a word (2 bytes) at a time */
   pageptr = offset;
@@ -119,22 +410,66 @@ write_page(uint8_t *page_buf, uint32_t offset) {
     pageptr += 2;
   } while(i -= 1);
   boot_page_write(offset);     // Store buffer in flash page.
-  boot_spm_busy_wait();        // Wait until the memory is written.
+  spm_busy_wait();             // Wait until the memory is written.
 
   /* Reenable RWW-section again. We need this if we want to jump back to the
    * application after bootloading. */
   boot_rww_enable();
 }
 
-/* Loads key into buff */
+/* Sets up ctx as mac_init() would for key_hmac. For HMAC-SHA256 by copying
+ * the precomputed midstates instead of compressing key^ipad and key^opad. */
 
-BOOTLOADER_SECTION static inline void
-load_key(uint8_t *buff, uint8_t *secret) {
+BOOTLOADER_SECTION static void
+load_mac_ctx(mac_ctx_t *ctx) {
+#ifdef MAC_SHA256
+  uint8_t *h;
+  uint8_t i;
+
+  h = (uint8_t*) ctx->a.h;
+  for(i=0; i<SHA256_HASH_BYTES; i++)
+    h[i] = pgm_read_byte_near(key_hmac_mid + i);
+  ctx->a.length = SHA256_BLOCK_BITS;
+
+  h = (uint8_t*) ctx->b.h;
+  for(i=0; i<SHA256_HASH_BYTES; i++)
+    h[i] = pgm_read_byte_near(key_hmac_mid + SHA256_HASH_BYTES + i);
+  ctx->b.length = SHA256_BLOCK_BITS;
+#else
+  uint8_t key[sizeof(key_hmac)];
   uint8_t i;
-  // Read page byte at a time
-  for(i=0; i<32; i++) {
-    buff[i] = pgm_read_byte_near(secret +i);
+
+  for(i=0; i<sizeof(key); i++)
+    key[i] = pgm_read_byte_near(key_hmac + i);
+  mac_init(ctx, key, sizeof(key)*8);
+  memzero_boot(key, sizeof(key));
+#endif
+}
+
+/* Stack the MAC engine uses below the caller of mac_*(): the deepest path is
+ * mac_lastBlock()/mac_final() into one SHA-256 compression. Must cover the
+ * largest call core/scripts/stack_usage.py reports for the engine's
+ * lastBlock and final functions (e.g. hmac_sha256_lastBlock,
+ * hmac_sha256_final). Wiped after keyed work, see mac_buf(). */
+#define MAC_STACK_BYTES 448
+
+/* MAC (MAC_BYTES) of length bytes at data into mac. Nothing keyed stays
+ * behind for the app to read: the context is wiped, and so is the stack the
+ * MAC engine used below this frame. */
+BOOTLOADER_SECTION static void
+mac_buf(uint8_t *mac, const uint8_t *data, uint8_t length) {
+  mac_ctx_t ctx;
+
+  load_mac_ctx(&ctx);
+  while(length > MAC_BLOCK_BYTES) {
+    mac_nextBlock(&ctx, data);
+    data += MAC_BLOCK_BYTES;
+    length -= MAC_BLOCK_BYTES;
   }
+  mac_lastBlock(&ctx, data, length*8);
+  mac_final(mac, &ctx);
+  memzero_boot(&ctx, sizeof(ctx));
+  stack_wipe_boot(MAC_STACK_BYTES);
 }
 
 /* Reads arbitrary page from progmem */
@@ -149,7 +484,110 @@ read_page(uint8_t *block_buf, uint32_t offset) {
   }
 }
 
-/* Activates image by transfering image from deploy to running app space */
+#ifdef ATT_SKIP_ERASED
+/* Returns 1 if the page at offset lies outside the live regions and is erased
+ * (all 0xFF). Live pages are never checked, they are always hashed. */
+BOOTLOADER_SECTION static uint8_t
+att_page_erased(uint16_t offset) {
+  uint16_t end;
+  uint16_t base;
+  uint8_t i;
+
+  /* Microvisor and both metadata headers */
+  if(offset >= MICROVISOR || offset == APP_META || offset == SHADOW_META)
+    return 0;
+
+  /* Running or staged image, up to .text + .data size in its header. An
+   * erased header (0xFFFF) means no image is recorded there. */
+  if(offset < APP_META) {
+    base = APP_START;
+    end = pgm_read_word_near(APP_META);
+  } else {
+    base = SHADOW;
+    end = pgm_read_word_near(SHADOW_META);
+  }
+  if(end != 0xFFFF && offset - base < end)
+    return 0;
+
+  /* One pass over the page, no hashing */
+  i = PAGE_SIZE/2;
+  do {
+    if(pgm_read_word_near(offset) != 0xFFFF)
+      return 0;
+    offset += 2;
+  } while(i -= 1);
+
+  return 1;
+}
+#endif
+
+#ifdef ATT_MERKLE
+/* Runs pages [offset, offset + pages*PAGE_SIZE) through a SHA-256 context.
+ * With ATT_SKIP_ERASED, elided pages are flagged in erased (one bit per page,
+ * LSB first, caller clears it) instead of being hashed. */
+BOOTLOADER_SECTION static void
+att_hash_pages(sha256_ctx_t *ctx, uint32_t offset, uint8_t pages, uint8_t *erased) {
+  uint8_t i;
+
+  for(i=0; i<pages; i++) {
+#ifdef ATT_SKIP_ERASED
+    if(att_page_erased(offset)) {
+      erased[i >> 3] |= 1 << (i & 0x07);
+      offset += PAGE_SIZE;
+      continue;
+    }
+#endif
+    /* Hash full page straight from flash */
+    sha256_nextBlocks_P(ctx, (const void*) (uint16_t) offset, PAGE_SIZE/SHA256_BLOCK_BYTES);
+    offset += PAGE_SIZE;
+  }
+}
+#endif
+
+/* Number of pages of the image whose metadata header is at meta */
+BOOTLOADER_SECTION static inline uint16_t
+image_pages(uint16_t meta) {
+  uint16_t size;
+
+  size = pgm_read_word_near(meta);
+  return size/PAGE_SIZE + (size%PAGE_SIZE > 0);
+}
+
+#ifdef SWAP_IMAGE
+/* Activates image by exchanging running and staged image page by page,
+ * metadata pages included. The previous image stays staged with its header,
+ * so verify_activate_image() brings it back without a transfer. Covers the
+ * larger of both images. */
+BOOTLOADER_SECTION static inline void
+switch_image() {
+  uint16_t pages;
+  uint16_t app_size;
+  uint16_t i;
+  uint8_t buf[PAGE_SIZE];
+  uint8_t tmp[PAGE_SIZE];
+
+  pages = image_pages(SHADOW_META);
+  /* An erased running header (0xFFFF) has no image to keep */
+  app_size = pgm_read_word_near(APP_META);
+  if(app_size <= APP_META - APP_START && image_pages(APP_META) > pages)
+    pages = image_pages(APP_META);
+
+  for(i=0; i<pages; i++) {
+    read_page(buf, ((uint32_t) SHADOW) + PAGE_SIZE*i);
+    read_page(tmp, APP_START + PAGE_SIZE*i);
+    write_page(buf, APP_START + PAGE_SIZE*i);
+    write_page(tmp, ((uint32_t) SHADOW) + PAGE_SIZE*i);
+  }
+
+  /* Swap metadata pages */
+  read_page(buf, SHADOW_META);
+  read_page(tmp, APP_META);
+  write_page(buf, APP_META);
+  write_page(tmp, SHADOW_META);
+}
+#else
+/* Activates image by transfering image from deploy to running app space.
+ * Pages that did not change are skipped by write_page(). */
 BOOTLOADER_SECTION static inline void
 switch_image() {
   uint16_t pages;
@@ -158,8 +596,7 @@ switch_image() {
 
   /* Calculate amount of pages to copy */
   //RAMPZ = 0x01;
-  pages = pgm_read_word_near(SHADOW_META);
-  pages = pages/PAGE_SIZE + (pages%PAGE_SIZE > 0);
+  pages = image_pages(SHADOW_META);
 
   for(i=0; i<pages; i++) {
     read_page(buf, ((uint32_t) SHADOW) + PAGE_SIZE*i);
@@ -170,33 +607,24 @@ switch_image() {
   read_page(buf, SHADOW_META);
   write_page(buf, APP_META);
 }
+#endif
 
-BOOTLOADER_SECTION static inline uint8_t
-verify_shadow() {
+/* Opcode scan of the staged image words [current_addr, end_addr) (word
+ * addresses relative to SHADOW). prev_op_long carries the state of the word
+ * before current_addr, so the text can be scanned in pieces. Returns 0 if an
+ * unsafe instruction or target is found. */
+BOOTLOADER_SECTION static uint8_t
+verify_shadow_words(uint16_t current_addr, uint16_t end_addr, uint8_t *prev_op_long) {
   uint16_t current_word;
-  uint16_t current_addr; //In WORDS, not bytes
   uint16_t pointer;
-  //uint8_t pointer_rampz;
-  uint16_t text_size; //In WORDS, not bytes
-  uint8_t prev_op_long;
-
-  /* Init text_size variable */
-  //RAMPZ = 0x01;
-  text_size = pgm_read_word_near(SHADOW_META + 2);
-  text_size >>= 1;
 
-  /* Loop over instructions word by word */
-  //pointer_rampz = 0x00;
-  pointer = SHADOW;
-  current_addr = 0x0000;
-  prev_op_long = 0;
-  while(current_addr < text_size) {
+  pointer = SHADOW + (current_addr << 1);
+  while(current_addr < end_addr) {
     /* Fetch next word */
-   // RAMPZ = pointer_rampz;
     current_word = pgm_read_word_near(pointer);
 
     /* Check target address of previous long op is correct */
-    if(prev_op_long && !verify_target_deploy(current_word))
+    if(*prev_op_long && !verify_target_deploy(current_word))
       return 0;
 
     /* Parse word as instruction and check if it is allowed. If this word is a
@@ -206,11 +634,11 @@ verify_shadow() {
       /* ---LONG INSTRUCTIONS WITH TARGET AS 2ND WORD--- */
       /* If target addr of long call gets decoded as long call and is not on
        * list, reject */
-      if(prev_op_long && verify_target_deploy(current_addr))
+      if(*prev_op_long && verify_target_deploy(current_addr))
         return 0;
       /* Set prev_op_long flag correctly: 1 in the normal case, and 0 if this
        * is the address of a long call. */
-      prev_op_long = !prev_op_long;
+      *prev_op_long = !*prev_op_long;
     } else {
       /* ---NORMAL INSTRUCTIONS--- */
 
@@ -227,7 +655,7 @@ verify_shadow() {
         /* PLAIN UNSAFE OPS: RET, RETI, IJMP, ICALL, LPM, LPM RD,Z(+) */
         /* In normal situation, reject. As target address of long call, reject
          * if not on list. */
-        if( !prev_op_long || (prev_op_long && verify_target_deploy(current_addr)) )
+        if( !*prev_op_long || (*prev_op_long && verify_target_deploy(current_addr)) )
           return 0;
       } else if((current_word & 0xFC00) == 0xF000
           || (current_word & 0xFC00) == 0xF400) {
@@ -252,96 +680,591 @@ verify_shadow() {
         if(!verify_target_deploy(current_word)) {
           /* In normal situation, reject. As target address of long call,
            * reject if not on list. */
-          if( !prev_op_long || (prev_op_long && verify_target_deploy(current_addr)) )
+          if( !*prev_op_long || (*prev_op_long && verify_target_deploy(current_addr)) )
             return 0;
         }
       }
 
       /* Set prev_op_long flag accordingly */
-      prev_op_long = 0;
+      *prev_op_long = 0;
     }
 
     /* Increment loop variables */
     current_addr++;
-    //if((pointer += 2) == 0x0000)
-      //pointer_rampz = 0x01;
+    pointer += 2;
   }
 
   return 1;
 }
 
+/* Full opcode scan of the staged image .text */
 BOOTLOADER_SECTION static inline uint8_t
-verify_hmac() {
-  uint16_t image_size; //in BYTES
-  uint8_t meta_size = 3; //in BYTES, without digest
-  uint8_t digest[32]; //HMAC_SHA1_BYTES
+verify_shadow() {
+  uint16_t text_size; //In WORDS, not bytes
+  uint8_t prev_op_long = 0;
+
+  /* Init text_size variable */
+  text_size = pgm_read_word_near(SHADOW_META + 2);
+  text_size >>= 1;
 
-  uint32_t offset = SHADOW;
-  hmac_sha256_ctx_t ctx;
-  uint8_t buff[PAGE_SIZE*2]; //Twice pagesize to simplify hashing
+  return verify_shadow_words(0x0000, text_size, &prev_op_long);
+}
+
+/* Completes the staged image MAC in ctx, which holds all full blocks of the
+ * image: MACs the last (semi)block and the metadata header up to its tag,
+ * then compares with that tag */
+BOOTLOADER_SECTION static uint8_t
+verify_hmac_final(mac_ctx_t *ctx) {
+  uint16_t offset;
+  uint8_t tail; //in BYTES, image bytes after the last full block
+  uint8_t meta_size = 3; //in BYTES, without digest
+  uint8_t digest[MAC_BYTES];
+  uint8_t buff[MAC_BLOCK_BYTES + PAGE_SIZE]; //Tail of the image + metadata page
+  uint8_t i;
 
-  /* Init image_size variable */
  // RAMPZ = 0x01;
-  image_size = pgm_read_word_near(SHADOW_META);
+  offset = pgm_read_word_near(SHADOW_META);
+  tail = offset % MAC_BLOCK_BYTES;
+  offset = SHADOW + offset - tail;
   meta_size += (uint8_t) pgm_read_word_near(SHADOW_META + 4);
   meta_size <<= 1; //Convert words to bytes
 
-  /* Init hmac context with key (load 20 byte key temporary in buff) */
-  load_key(buff,key_hmac);
-  hmac_sha256_init(&ctx, buff, 256);
-
-  /* Hash full app pages first */
-  while(image_size >= PAGE_SIZE) {
-    read_page(buff, offset);
-    /* Hash full page, unroll loop */
-    hmac_sha256_nextBlock(&ctx, buff);
-    hmac_sha256_nextBlock(&ctx, buff + HMAC_SHA256_BLOCK_BYTES);
-    hmac_sha256_nextBlock(&ctx, buff + HMAC_SHA256_BLOCK_BYTES*2);
-    hmac_sha256_nextBlock(&ctx, buff + HMAC_SHA256_BLOCK_BYTES*3);
+  /* Hash last (semi)block + metadata */
+  for(i=0; i<tail; i++)
+    buff[i] = pgm_read_byte_near(offset + i);
+  read_page(buff + tail, SHADOW_META);
+  mac_lastBlock(ctx, buff, (tail + meta_size)*8);
+  memcpy_boot(digest, buff+tail+meta_size, MAC_BYTES); //Backup digest from metadata page
+
+  /* Finalize + compare. The MAC of a rejected image would let the app
+   * forge its tag: nothing of it stays on the stack. */
+  mac_final(buff, ctx);
+  i = (memcmp_boot(buff, digest, MAC_BYTES) == 0);
+  memzero_boot(buff, sizeof(buff));
+
+  return i;
+}
+
+/* Full MAC check of the staged image. The keyed context only lives on the
+ * stack and is wiped before returning. */
+BOOTLOADER_SECTION static inline uint8_t
+verify_hmac() {
+  uint16_t image_size; //in BYTES
+  uint16_t offset = SHADOW;
+  mac_ctx_t ctx;
+  uint8_t i;
+
+  /* Init image_size variable */
+  image_size = pgm_read_word_near(SHADOW_META);
+
+  /* Init mac context with key */
+  load_mac_ctx(&ctx);
+
+  /* Hash all full blocks of the image straight from flash, at most 255
+   * blocks per call */
+  while(image_size >= MAC_BLOCK_BYTES) {
+    i = (image_size / MAC_BLOCK_BYTES > 0xFF) ? 0xFF : image_size / MAC_BLOCK_BYTES;
+    mac_nextBlocks_P(&ctx, (const void*) offset, i);
     /* Book keeping */
-    image_size -= PAGE_SIZE;
-    offset += PAGE_SIZE;
+    image_size -= i * MAC_BLOCK_BYTES;
+    offset += i * MAC_BLOCK_BYTES;
   }
 
-  /* Hash last (semi)page + metadata */
-  read_page(buff, offset);
-  read_page(buff + image_size, SHADOW_META);
-  hmac_sha256_lastBlock(&ctx, buff, (image_size + meta_size)*8);
-  memcpy_boot(digest, buff+image_size+meta_size, 32); //Backup digest from metadata page
+  i = verify_hmac_final(&ctx);
+  memzero_boot(&ctx, sizeof(ctx));
+  /* verify_hmac_final() frame on top of the MAC engine */
+  stack_wipe_boot(MAC_STACK_BYTES + MAC_BLOCK_BYTES + PAGE_SIZE + MAC_BYTES);
+  return i;
+}
+
+/* Byte address of the MAC in the metadata header at meta */
+BOOTLOADER_SECTION static uint16_t
+meta_mac(uint16_t meta) {
+  return meta + ((3 + pgm_read_word_near(meta + 4)) << 1);
+}
+
+/* Records the page just written at SHADOW + offset in EEPROM, see
+ * LOAD_PROGRESS_SIZE. A header with a different MAC starts over with no
+ * pages; the bitmap is cleared before the MAC is replaced, so a reset in
+ * between loses progress but never claims a page. */
+BOOTLOADER_SECTION static void
+load_record(uint16_t offset) {
+  uint16_t mac;
+  uint8_t page;
+  uint8_t i;
 
-  /* Finalize + compare */
-  hmac_sha256_final(buff, &ctx);
-  if(memcmp_boot(buff, digest, 32) != 0)
+  ee_busy_wait();
+  if(offset == SHADOW_META - SHADOW) {
+    mac = meta_mac(SHADOW_META);
+    for(i=0; i<MAC_BYTES; i++)
+      if(ee_read(EE_LOAD_MAC + i) != pgm_read_byte_near(mac + i))
+        break;
+    if(i == MAC_BYTES)
+      return;
+    for(i=0; i<LOAD_PROGRESS_SIZE; i++)
+      ee_update(EE_LOAD_PAGES + i, 0);
+    for(i=0; i<MAC_BYTES; i++)
+      ee_update(EE_LOAD_MAC + i, pgm_read_byte_near(mac + i));
+    return;
+  }
+
+  /* Pages of the image count once written whole, a partial write makes the
+   * page missing again */
+  if(offset >= pgm_read_word_near(SHADOW_META))
+    return;
+  page = offset / PAGE_SIZE;
+  i = ee_read(EE_LOAD_PAGES + (page >> 3));
+  if(offset % PAGE_SIZE)
+    i &= ~(1 << (page & 0x07));
+  else
+    i |= 1 << (page & 0x07);
+  ee_update(EE_LOAD_PAGES + (page >> 3), i);
+}
+
+/* Copies the recorded page bitmap to pages if it belongs to the header in
+ * SHADOW and returns 1, otherwise clears pages and returns 0 */
+BOOTLOADER_SECTION static uint8_t
+load_progress_read(uint8_t *pages) {
+  uint16_t mac;
+  uint8_t i;
+  uint8_t ok;
+
+  ee_busy_wait();
+  mac = meta_mac(SHADOW_META);
+  for(i=0; i<MAC_BYTES; i++)
+    if(ee_read(EE_LOAD_MAC + i) != pgm_read_byte_near(mac + i))
+      break;
+  ok = (i == MAC_BYTES);
+
+  for(i=0; i<LOAD_PROGRESS_SIZE; i++)
+    pages[i] = ok ? ee_read(EE_LOAD_PAGES + i) : 0;
+  return ok;
+}
+
+/* Forgets the load progress, SHADOW no longer holds what it describes: a
+ * MAC that no header has makes load_progress() and the next header ignore
+ * the bitmap */
+BOOTLOADER_SECTION static void
+load_record_clear() {
+  ee_update(EE_LOAD_MAC, ~ee_read(EE_LOAD_MAC));
+}
+
+/* 0 if a page list is in force and page is not the one it lists for SHADOW
+ * + offset: not written, no erase cycle spent. Pages past the image and
+ * partial pages are not listed. A header (re)starts without a list. Runs
+ * with interrupts off, the UART is drained before each of the five SHA-256
+ * blocks instead. */
+BOOTLOADER_SECTION static uint8_t
+load_page_check(const uint8_t *page, uint16_t offset) {
+#ifdef OTA_PAGE_LIST
+  sha256_ctx_t ctx;
+  uint8_t digest[SHA256_HASH_BYTES];
+  uint8_t i;
+
+  if(offset >= SHADOW_META - SHADOW) {
+    page_list.magic = 0;
+    return 1;
+  }
+  if(page_list.magic != PAGE_LIST_MAGIC)
+    return 1;
+  if(offset % PAGE_SIZE || offset >= pgm_read_word_near(SHADOW_META))
     return 0;
 
+  sha256_init(&ctx);
+  for(i=0; i<PAGE_SIZE/SHA256_BLOCK_BYTES; i++) {
+    load_rx_drain();
+    sha256_nextBlock(&ctx, page + i*SHA256_BLOCK_BYTES);
+  }
+  load_rx_drain();
+  sha256_lastBlock(&ctx, &offset, 16);
+  load_rx_drain();
+  sha256_ctx2hash((sha256_hash_t*) digest, &ctx);
+
+  ee_busy_wait();
+  for(i=0; i<PAGE_HASH_BYTES; i++)
+    if(ee_read(EE_PAGE_LIST
+          + offset/PAGE_SIZE*PAGE_HASH_BYTES + i) != digest[i])
+      return 0;
+#endif
   return 1;
 }
 
+#ifdef OTA_PAGE_LIST
+/* 1 if mac is the MAC over the header MAC in SHADOW and the size bytes of
+ * page list in EEPROM */
+BOOTLOADER_SECTION static uint8_t
+page_list_verify(const uint8_t *mac, uint16_t size) {
+  mac_ctx_t ctx;
+  uint8_t buf[MAC_BLOCK_BYTES];
+  uint16_t meta;
+  uint16_t j;
+  uint8_t n = 0;
+
+  load_mac_ctx(&ctx);
+  meta = meta_mac(SHADOW_META);
+  ee_busy_wait();
+  /* The last (semi)block stays for mac_lastBlock(), never empty */
+  for(j=0; j<MAC_BYTES + size; j++) {
+    if(n == MAC_BLOCK_BYTES) {
+      mac_nextBlock(&ctx, buf);
+      n = 0;
+    }
+    buf[n++] = (j < MAC_BYTES) ? pgm_read_byte_near(meta + j)
+      : ee_read(EE_PAGE_LIST + j - MAC_BYTES);
+  }
+  mac_lastBlock(&ctx, buf, n*8);
+  mac_final(buf, &ctx);
+  /* The MAC over a list the app wrote must not stay behind, see mac_buf() */
+  n = (memcmp_boot(buf, mac, MAC_BYTES) == 0);
+  memzero_boot(&ctx, sizeof(ctx));
+  memzero_boot(buf, sizeof(buf));
+  stack_wipe_boot(MAC_STACK_BYTES);
+  return n;
+}
+#endif
+
+#ifdef OTA_LZ
+/* Decodes a compressed page frame (format in core/scripts/lz_page.py) for
+ * SHADOW + offset into page. Matches that reach before the page read the
+ * earlier image pages from SHADOW, so the page buffer is the only window in
+ * SRAM. Returns 0 for a malformed frame. */
+BOOTLOADER_SECTION static uint8_t
+lz_decode(uint8_t *page, uint16_t offset, const uint8_t *in, uint16_t length) {
+  const uint8_t *end = in + length;
+  uint16_t out = 0;
+  uint16_t dist;
+  uint8_t count;
+  uint8_t flags;
+  uint8_t bit;
+
+  while(in < end) {
+    flags = *in++;
+    for(bit=0; bit<8 && in<end; bit++, flags >>= 1) {
+      if(flags & 1) {
+        /* Match: 12 bit distance - 1, 4 bit length - 3 */
+        if(end - in < 2)
+          return 0;
+        dist = (in[0] | (uint16_t) (in[1] >> 4) << 8) + 1;
+        count = (in[1] & 0x0F) + 3;
+        in += 2;
+        if(dist > offset + out || count > PAGE_SIZE - out)
+          return 0;
+        do {
+          page[out] = (dist <= out) ? page[out - dist]
+              : pgm_read_byte_near(SHADOW + offset + out - dist);
+          out++;
+        } while(--count);
+      } else {
+        /* Literal */
+        if(out == PAGE_SIZE)
+          return 0;
+        page[out++] = *in++;
+      }
+    }
+  }
+
+  /* Short last page */
+  while(out < PAGE_SIZE)
+    page[out++] = 0xFF;
+
+  return 1;
+}
+#endif
+
+#ifdef ATT_MERKLE
+/* SHA-256 of tree leaf leaf into digest, see att_tree_t */
+BOOTLOADER_SECTION static void
+att_leaf_hash(uint8_t *digest, uint8_t leaf) {
+  sha256_ctx_t ctx;
+  uint8_t erased[ATT_LEAF_PAGES/8];
+  uint8_t i;
+
+  for(i=0; i<sizeof(erased); i++)
+    erased[i] = 0;
+  sha256_init(&ctx);
+  att_hash_pages(&ctx, (uint32_t) leaf * PAGE_SIZE * ATT_LEAF_PAGES,
+      ATT_LEAF_PAGES, erased);
+#ifdef ATT_SKIP_ERASED
+  sha256_lastBlock(&ctx, erased, ATT_LEAF_PAGES);
+#else
+  sha256_lastBlock(&ctx, erased, 0);
+#endif
+  sha256_ctx2hash((sha256_hash_t*) digest, &ctx);
+}
+
+/* Brings the digest tree up to date and copies its root to root. On a
+ * prover whose flash did not change since the last call this is one tag
+ * check. Otherwise the dirty leaves are rehashed and the root is rebuilt
+ * from a copy of each pair of leaves, which also runs the old leaves
+ * through the old root: if the clean ones do not match it, all leaves are
+ * rehashed. */
+BOOTLOADER_SECTION static void
+att_tree_update(uint8_t *root) {
+  sha256_ctx_t old;
+  sha256_ctx_t next;
+  uint8_t buf[2*SHA256_HASH_BYTES];
+  uint8_t leaf;
+  uint8_t i;
+  uint8_t trusted;
+
+  /* Check the copy, the app may change the tree meanwhile */
+  memcpy_boot(root, att_tree.root, SHA256_HASH_BYTES);
+  mac_buf(buf, root, SHA256_HASH_BYTES);
+  trusted = att_tree.magic == ATT_TREE_MAGIC
+      && memcmp_boot(buf, att_tree.tag, MAC_BYTES) == 0;
+  /* The tag of whatever the app put there would make it valid */
+  memzero_boot(buf, sizeof(buf));
+  if(trusted) {
+    for(i=0; i<sizeof(att_tree.dirty) && !att_tree.dirty[i]; i++)
+      ;
+    if(i == sizeof(att_tree.dirty))
+      return;
+  }
+
+  while(1) {
+    sha256_init(&old);
+    sha256_init(&next);
+    for(leaf=0; leaf<ATT_LEAVES; leaf+=2) {
+      memcpy_boot(buf, att_tree.leaf[leaf], sizeof(buf));
+      if(trusted)
+        sha256_nextBlock(&old, buf);
+      for(i=0; i<2; i++) {
+        if(trusted && !(att_tree.dirty[(leaf + i) >> 3] & (1 << ((leaf + i) & 0x07))))
+          continue;
+        /* Clear first: a write_page() during the rehash marks it dirty
+         * again */
+        att_tree.dirty[(leaf + i) >> 3] &= ~(1 << ((leaf + i) & 0x07));
+        att_leaf_hash(buf + i*SHA256_HASH_BYTES, leaf + i);
+        memcpy_boot(att_tree.leaf[leaf + i], buf + i*SHA256_HASH_BYTES, SHA256_HASH_BYTES);
+      }
+      sha256_nextBlock(&next, buf);
+    }
+    if(!trusted)
+      break;
+    sha256_lastBlock(&old, buf, 0);
+    sha256_ctx2hash((sha256_hash_t*) buf, &old);
+    if(memcmp_boot(buf, root, SHA256_HASH_BYTES) == 0)
+      break;
+    trusted = 0;
+  }
+
+  sha256_lastBlock(&next, buf, 0);
+  sha256_ctx2hash((sha256_hash_t*) root, &next);
+  memcpy_boot(att_tree.root, root, SHA256_HASH_BYTES);
+  mac_buf(att_tree.tag, root, SHA256_HASH_BYTES);
+  att_tree.magic = ATT_TREE_MAGIC;
+}
+#endif
+
 /****************************************************************************/
 /*                        MICROVISOR CORE FUNCTIONS                         */
 /****************************************************************************/
 
+/* __do_copy_data of the app (do_copy_data_lpm.S): copies length bytes of app
+ * flash at src to dest. App .text cannot read flash itself, verify_shadow()
+ * refuses lpm there. src must lie below APP_META, so the microvisor and its
+ * key stay unreadable, and dest must end below the stack pointer, so the
+ * return address is not overwritten. */
+
+BOOTLOADER_SECTION void
+copy_data(uint8_t *dest, uint16_t src, uint16_t length) {
+  if(src >= APP_META || length > APP_META - src || (uint16_t) dest + length > SP)
+    return;
+  while(length--)
+    *dest++ = pgm_read_byte_near(src++);
+}
+
 /* ALWAYS first disable global interrupts as first order of business in these
  * fucntions. Failing to do so could have untrusted interrupt handlers modify
  * the state and outcome of any of these trusted functions. */
 
 /* Writes page contained in page_buf (256 bytes) to offset in deployment space
- * (0xFE00-0x1FC00) */
+ * (0xFE00-0x1FC00), about 9 ms of flash programming. Scan and MAC are left
+ * for verify_activate_image(). With a page list in force
+ * (load_page_list()) the page is checked against it first, serving the
+ * UART (load_rx()) between the SHA-256 blocks. Returns 1 if the page was
+ * written, 0 if it is outside the deployment space or not the listed one. */
 
-BOOTLOADER_SECTION void
+BOOTLOADER_SECTION uint8_t
 load_image(uint8_t *page_buf, uint16_t offset) {
   uint8_t sreg;
+  uint8_t ok = 0;
   sreg = SREG;
   cli();
 
   /* Write page if it is within the allowable space */
-  if(offset<SHADOW)
+  if(offset<SHADOW && load_page_check(page_buf, offset)) {
     write_page(page_buf, ((uint32_t) SHADOW) + offset);
+    load_record(offset);
+    ok = 1;
+  }
+
+  SREG = sreg;
+  sei();
+  return ok;
+}
+
+#ifdef OTA_DELTA
+/* Delta updates: copies the running app page at offset to the same offset in
+ * deployment space, as if load_image() had received it. Only done if mac (the
+ * delta base, MAC_BYTES) is the MAC in the running image's header, offset
+ * is a page inside the app region and the page is the listed one if a page
+ * list is in force. Returns 1 on success, 0 otherwise. */
+
+BOOTLOADER_SECTION uint8_t
+load_image_copy(uint16_t offset, const uint8_t *mac) {
+  uint8_t sreg;
+  uint8_t buf[PAGE_SIZE];
+  uint16_t meta;
+  uint8_t i;
+  uint8_t ok = 0;
+  sreg = SREG;
+  cli();
+
+  /* Running image header: tag after the sizes and the 2nd word list */
+  meta = meta_mac(APP_META);
+  for(i=0; i<MAC_BYTES; i++)
+    if(pgm_read_byte_near(meta + i) != mac[i])
+      break;
+
+  if(i == MAC_BYTES && offset < APP_META && !(offset % PAGE_SIZE)) {
+    read_page(buf, APP_START + offset);
+    ok = load_page_check(buf, offset);
+  }
+  if(ok) {
+    write_page(buf, ((uint32_t) SHADOW) + offset);
+    load_record(offset);
+  }
+
+  SREG = sreg;
+  sei();
+  return ok;
+}
+#endif
+
+#ifdef OTA_LZ
+/* Compressed load_image(): decodes frame (length bytes, at most LZ_FRAME_MAX)
+ * and writes the page to offset in deployment space. Earlier pages of the
+ * image must be loaded already, the frame may refer to them. Returns 1 on
+ * success, 0 for a malformed frame or offset, or a decoded page that is not
+ * the listed one. */
+
+BOOTLOADER_SECTION uint8_t
+load_image_lz(const uint8_t *frame, uint16_t length, uint16_t offset) {
+  uint8_t sreg;
+  uint8_t page[PAGE_SIZE];
+  uint8_t ok = 0;
+  sreg = SREG;
+  cli();
+
+  if(offset < SHADOW && !(offset % PAGE_SIZE) && length <= LZ_FRAME_MAX
+      && lz_decode(page, offset, frame, length) && load_page_check(page, offset)) {
+    write_page(page, ((uint32_t) SHADOW) + offset);
+    load_record(offset);
+    ok = 1;
+  }
+
+  SREG = sreg;
+  sei();
+  return ok;
+}
+#endif
+
+/* Attaches (attach != 0) an empty receive ring to the load functions and
+ * returns it, or detaches it and returns NULL. While attached, the UART
+ * receiver is drained into the ring during flash programming and the page
+ * list check, so the app can take the next page while the previous one is
+ * written (see apps/secure_loading). The app's receive interrupt must fill
+ * the same ring. */
+
+BOOTLOADER_SECTION load_rx_ring_t *
+load_rx(uint8_t attach) {
+  uint8_t sreg;
+  load_rx_ring_t *ring = NULL;
+  sreg = SREG;
+  cli();
+
+  load_rx_state.magic = 0;
+  if(attach) {
+    load_rx_state.ring.head = 0;
+    load_rx_state.ring.tail = 0;
+    load_rx_state.magic = LOAD_RX_MAGIC;
+    ring = &load_rx_state.ring;
+  }
+
+  SREG = sreg;
+  sei();
+  return ring;
+}
+
+/* Resume point of an interrupted load: if mac (MAC_BYTES) is the MAC of the
+ * image in SHADOW and of the recorded progress, copies the bitmap of its
+ * pages already written (LOAD_PROGRESS_SIZE bytes, bit i for the page at
+ * PAGE_SIZE*i) to pages and returns 1. Otherwise pages is all 0 and 0 is
+ * returned. Only a hint: the image MAC decides at activation, and a failed
+ * activation forgets the progress. */
+
+BOOTLOADER_SECTION uint8_t
+load_progress(const uint8_t *mac, uint8_t *pages) {
+  uint8_t sreg;
+  uint16_t meta;
+  uint8_t i;
+  uint8_t ok;
+  sreg = SREG;
+  cli();
+
+  meta = meta_mac(SHADOW_META);
+  for(i=0; i<MAC_BYTES; i++)
+    if(pgm_read_byte_near(meta + i) != mac[i])
+      break;
+  ok = (i == MAC_BYTES) && load_progress_read(pages);
 
   SREG = sreg;
   sei();
+  return ok;
 }
 
+#ifdef OTA_PAGE_LIST
+/* Page list of the image whose header is in SHADOW, see PAGE_HASH_BYTES:
+ * part holds bytes [offset, offset + length) of the list followed by its
+ * MAC. Parts go to EEPROM in any order (ee_update(), so a list sent again
+ * costs no writes); the MAC must come whole in the last part, which checks it
+ * and puts the list in force. Any part drops a list in force until then.
+ * Returns 2 once the list is in force, 1 for a part taken, 0 for a part out
+ * of range or a MAC that does not match. */
+
+BOOTLOADER_SECTION uint8_t
+load_page_list(const uint8_t *part, uint16_t offset, uint16_t length) {
+  uint8_t sreg;
+  uint16_t size;
+  uint16_t i;
+  uint8_t ok = 0;
+  sreg = SREG;
+  cli();
+
+  page_list.magic = 0;
+  size = image_pages(SHADOW_META)*PAGE_HASH_BYTES;
+  if(size <= PAGE_LIST_SIZE && length && offset < size + MAC_BYTES
+      && length <= size + MAC_BYTES - offset) {
+    for(i=0; i<length && offset + i < size; i++)
+      ee_update(EE_PAGE_LIST + offset + i, part[i]);
+    ok = 1;
+
+    if(offset + length == size + MAC_BYTES) {
+      ok = 0;
+      if(offset <= size && page_list_verify(part + size - offset, size)) {
+        page_list.magic = PAGE_LIST_MAGIC;
+        ok = 2;
+      }
+    }
+  }
+
+  SREG = sreg;
+  sei();
+  return ok;
+}
+#endif
+
 /* Verifies and activates an image from deployment app space to running app space.
  * When successful, this function will not return but perform a soft reset. In
  * case of failure, 0 (false) is returned */
@@ -349,11 +1272,23 @@ load_image(uint8_t *page_buf, uint16_t offset) {
 BOOTLOADER_SECTION uint8_t
 verify_activate_image() {
   uint8_t sreg;
+  uint8_t ok;
   sreg = SREG;
   cli();
 
-  if(!verify_shadow() || !verify_hmac())
+  /* Rescan all of SHADOW: no scan or MAC state is kept between calls, the
+   * app could tamper with it */
+  ok = verify_shadow() && verify_hmac();
+  /* Installed or rejected, nothing left to resume */
+  load_record_clear();
+#ifdef OTA_PAGE_LIST
+  page_list.magic = 0;
+#endif
+
+  if(!ok) {
+    SREG = sreg;
     return 0;
+  }
 
   /* We passed all tests, activate new image and jump to it */
   switch_image();
@@ -362,92 +1297,507 @@ verify_activate_image() {
   goto *(0x0000);
 }
 
-/* Remote attestation */
+/* Starts a scan of all flash for nonce (20 bytes) in att_scan, without the
+ * tag */
+BOOTLOADER_SECTION static void
+att_scan_begin(const uint8_t *nonce) {
+  sha256_init(&att_scan.ctx);
+#ifdef ATT_BOOT_FIRST
+  /* Microvisor region is already in the build-time state */
+  for(uint8_t i=0; i<SHA256_HASH_BYTES; i++)
+    ((uint8_t*) att_scan.ctx.h)[i] = pgm_read_byte_near(BOOT_MIDSTATE + i);
+  att_scan.ctx.length = (MEM_END + 1UL - MICROVISOR)*8;
+#endif
+#ifdef ATT_SKIP_ERASED
+  memzero_boot(att_scan.erased, ATT_ERASED_MAP_SIZE);
+#endif
+  memcpy_boot(att_scan.nonce, nonce, 20);
+  att_scan.page = 0;
+  att_scan.block = 0;
+  att_scan.magic = ATT_SCAN_MAGIC;
+}
+
+/* Hashes at most blocks units of work of the scan in att_scan: one 64 byte
+ * compression, or one erased page check with ATT_SKIP_ERASED. Returns the
+ * number of pages left. */
+BOOTLOADER_SECTION static uint8_t
+att_scan_run(uint8_t blocks) {
+  uint16_t offset;
+  uint8_t n;
+
+  while(blocks && att_scan.page < ATT_SCAN_PAGES) {
+    offset = APP_START + (uint16_t) att_scan.page * PAGE_SIZE;
+#ifdef ATT_SKIP_ERASED
+    if(att_scan.block == 0 && att_page_erased(offset)) {
+      att_scan.erased[att_scan.page >> 3] |= 1 << (att_scan.page & 0x07);
+      att_scan.page++;
+      blocks--;
+      continue;
+    }
+#endif
+    /* Rest of this page, as far as the budget goes */
+    offset += att_scan.block * SHA256_BLOCK_BYTES;
+    n = PAGE_SIZE/SHA256_BLOCK_BYTES - att_scan.block;
+    if(n > blocks)
+      n = blocks;
+    sha256_nextBlocks_P(&att_scan.ctx, (const void*) offset, n);
+
+    att_scan.block += n;
+    if(att_scan.block == PAGE_SIZE/SHA256_BLOCK_BYTES) {
+      att_scan.block = 0;
+      att_scan.page++;
+    }
+    blocks -= n;
+  }
+
+  return ATT_SCAN_PAGES - att_scan.page;
+}
+
+/* Completes the scan in att_scan: MAC (MAC_BYTES) over its memory digest,
+ * the nonce and the order version (ATT_BOOT_FIRST) into mac */
+BOOTLOADER_SECTION static void
+att_scan_end(uint8_t *mac) {
+  uint8_t buf[SHA256_HASH_BYTES + 20 + 1];
+  uint8_t i;
+
+#ifdef ATT_SKIP_ERASED
+  sha256_lastBlock(&att_scan.ctx, att_scan.erased, ATT_ERASED_MAP_SIZE*8);
+#else
+  sha256_lastBlock(&att_scan.ctx, buf, 0);
+#endif
+  sha256_ctx2hash((sha256_hash_t*) buf, &att_scan.ctx);
+  att_scan.magic = 0;
+
+  memcpy_boot(buf + SHA256_HASH_BYTES, att_scan.nonce, 20);
+  i = SHA256_HASH_BYTES + 20;
+#ifdef ATT_BOOT_FIRST
+  buf[i++] = ATT_ORDER_BOOT_FIRST;
+#endif
+  mac_buf(mac, buf, i);
+}
+
+#ifdef ATT_SLICED
+/* MAC over the scan state after magic, see att_scan_t */
+BOOTLOADER_SECTION static void
+att_scan_tag(uint8_t *tag) {
+  mac_buf(tag, &att_scan.page, att_scan.tag - &att_scan.page);
+}
+
+/* 1 if a scan is in progress and att_scan is as the microvisor left it,
+ * otherwise drops the scan */
+BOOTLOADER_SECTION static uint8_t
+att_scan_valid() {
+  uint8_t tag[MAC_BYTES];
+
+  if(att_scan.magic != ATT_SCAN_MAGIC)
+    return 0;
+  att_scan_tag(tag);
+  if(memcmp_boot(tag, att_scan.tag, MAC_BYTES) != 0)
+    att_scan.magic = 0;
+  /* The tag of whatever the app put there would make it valid */
+  memzero_boot(tag, sizeof(tag));
+
+  return att_scan.magic == ATT_SCAN_MAGIC;
+}
+
+/* Starts a time-sliced attestation of all flash over nonce (20 bytes). The
+ * MAC is the same one remote_attestation() returns. Any scan in progress is
+ * dropped. */
+BOOTLOADER_SECTION void
+att_start(const uint8_t *nonce) {
+  uint8_t sreg;
+  sreg = SREG;
+  cli();
+
+  att_scan_begin(nonce);
+  att_scan_tag(att_scan.tag);
+
+  SREG = sreg;
+  sei();
+}
+
+/* Runs at most blocks units of work of the scan started by att_start(). A
+ * unit is one 64 byte compression, or one erased page check with
+ * ATT_SKIP_ERASED. Checking and renewing the scan tag adds six compressions
+ * to every call, so the budget should be well above that.
+ * Returns the number of pages left, 0 once att_finish() can be called (or
+ * when no scan is running). */
+BOOTLOADER_SECTION uint8_t
+att_step(uint8_t blocks) {
+  uint8_t sreg;
+  uint8_t left = 0;
+  sreg = SREG;
+  cli();
+
+  if(att_scan_valid()) {
+    left = att_scan_run(blocks);
+    att_scan_tag(att_scan.tag);
+  }
+
+  SREG = sreg;
+  sei();
+  return left;
+}
+
+/* Writes the MAC (MAC_BYTES) of a completed scan to mac. Returns 0 if no scan
+ * was started, it is not done yet, write_page() ran in between or the scan
+ * state was tampered with. */
+BOOTLOADER_SECTION uint8_t
+att_finish(uint8_t *mac) {
+  uint8_t sreg;
+  uint8_t ok;
+  sreg = SREG;
+  cli();
+
+  ok = att_scan_valid() && att_scan.page == ATT_SCAN_PAGES;
+  if(ok)
+    att_scan_end(mac);
+
+  SREG = sreg;
+  sei();
+  return ok;
+}
+
+#endif
+/* Remote attestation. mac holds the 20 byte nonce on entry and the MAC
+ * (MAC_BYTES) on return, so it must be large enough for both. */
 BOOTLOADER_SECTION void 
 remote_attestation(uint8_t *mac) {
+  att_scan_begin(mac);
+  while(att_scan_run(0xFF))
+    ;
+  att_scan_end(mac);
+}
 
-  
-//  uint8_t sreg;
-//  sreg = SREG;
-//  cli();
+/* Digest of all flash, independent of any verifier nonce. Freshness comes
+ * from the response MAC over the nonce, see att_resp_fill(). Only recomputed
+ * after flash was written since the last call. Returns 0 if it has to be
+ * recomputed while an att_start() scan is in progress (without ATT_MERKLE):
+ * the full scan would drop it. */
+BOOTLOADER_SECTION static uint8_t att_memory_state(uint8_t *memory_state) {
+#ifdef ATT_MERKLE
+  /* Memory state is the tree root, only dirty leaves are rehashed */
+  att_tree_update(memory_state);
+#else
+  if(att_state.magic != ATT_STATE_MAGIC) {
+    if(att_scan.magic == ATT_SCAN_MAGIC)
+      return 0;
+    /* Full scan MAC over an all-zero nonce */
+    memzero_boot(att_state.digest, 32);
+    remote_attestation(att_state.digest);
+    att_state.magic = ATT_STATE_MAGIC;
+  }
+  memcpy_boot(memory_state, att_state.digest, 32);
+#endif
+  return 1;
+}
 
- hmac_sha256_ctx_t ctx;
- uint8_t buff[PAGE_SIZE];
- uint32_t offset;
+/* Computes the memory state ahead of the first att_req, call once at app
+ * startup. .bootbss survives a reset (e.g. an ISP reflash), so whatever is
+ * cached there is dropped and the state is computed from flash. Without
+ * ATT_MERKLE nothing is computed while an att_start() scan is in progress. */
+BOOTLOADER_SECTION void att_init() {
+  uint8_t sreg;
+  uint8_t memory_state[32];
+  sreg = SREG;
+  cli();
 
-  // Init hmac context with key (load 20 byte key temporary in buff)
- load_key(buff,key_hmac);
- 
- hmac_sha256_init(&ctx, buff, 256);
+#ifdef ATT_MERKLE
+  att_tree.magic = 0;
+#else
+  att_state.magic = 0;
+#endif
+  att_memory_state(memory_state);
 
-  // Hash full image
-  offset = 0x00;
-  while(offset < MEM_END) {
-    read_page(buff, offset);
-    // Run block through HMAC, unroll loop
-    hmac_sha256_nextBlock(&ctx, buff);
-    hmac_sha256_nextBlock(&ctx, buff + HMAC_SHA256_BLOCK_BYTES);
-    hmac_sha256_nextBlock(&ctx, buff + HMAC_SHA256_BLOCK_BYTES*2);
-    hmac_sha256_nextBlock(&ctx, buff + HMAC_SHA256_BLOCK_BYTES*3);
-    // Increment counter
-    offset += 0x100;
+  SREG = sreg;
+  sei();
+}
+
+/* Common head of all attestation responses: ver_mac[0:6], self_id[14:16],
+ * ctr[16:18], nonce[18:34], keyword[34:42] */
+BOOTLOADER_SECTION static void att_resp_header(uint8_t *result_msg, uint16_t ctr, const uint8_t *nonce, uint64_t att_resp_keyword) {
+  uint16_t self_id = 1000;
+  uint8_t ver_mac[] = {0x02, 0x00, 0x00, 0x99, 0x99, 0x99};
+
+  memcpy_boot(result_msg, ver_mac, 6);
+  memcpy_boot(result_msg + 14, &self_id, 2);
+  memcpy_boot(result_msg + 16, &ctr, 2);
+  memcpy_boot(result_msg + 18, nonce, 16);
+  memcpy_boot(result_msg + 34, &att_resp_keyword, 8);
+}
+
+/* MACs result_msg[0:length] into result_msg[length:length+MAC_BYTES] */
+BOOTLOADER_SECTION static void att_resp_mac(uint8_t *result_msg, uint8_t length) {
+  mac_buf(result_msg + length, result_msg, length);
+}
+
+/* Builds one att_resp message for (ctr, nonce) around memory_state
+ * ([42:74]) and MACs it. The MAC covers [0:length], so extended responses
+ * put their fields at [74:length] before calling. */
+BOOTLOADER_SECTION static void att_resp_fill(uint8_t *result_msg, uint16_t ctr, const uint8_t *nonce, const uint8_t *memory_state, uint8_t length, uint64_t att_resp_keyword) {
+  att_resp_header(result_msg, ctr, nonce, att_resp_keyword);
+  memcpy_boot(result_msg + 42, memory_state, 32);
+  att_resp_mac(result_msg, length);
+}
+
+/* att_req: returns 0 (no response) if the memory state is not available,
+ * see att_memory_state() */
+BOOTLOADER_SECTION uint8_t att_resp(uint8_t *msg_buf, uint8_t *result_msg, uint8_t *metadata) {
+  uint16_t ctr;
+  uint8_t memory_state[32];
+
+  for(uint16_t i = 0; i < HASH_MAP_SIZE; i++) {
+    metadata[i] = 0;
   }
 
+  memcpy_boot(&ctr, msg_buf + 22, 2);
+  if(!att_memory_state(memory_state))
+    return 0;
 
-  // Hash nonce
-  hmac_sha256_lastBlock(&ctx, mac, 20*8); //20 byte nonce
+  att_resp_fill(result_msg, ctr, msg_buf + 24, memory_state, ATT_RESP_MAC_OFFSET, 0x6666666666666666);
+  return 1;
+}
+
+#ifdef ATT_BATCH
+/* Answers n attestation requests with a single memory scan. reqs holds n
+ * (ctr, nonce) tuples of ATT_BATCH_REQ_SIZE bytes (ctr[0:2], nonce[2:18]) as
+ * found at [22:40] of an att_req message. result_msgs receives n att_resp
+ * messages of ATT_RESP_SIZE bytes, each MACed on its own. Returns 0 and
+ * answers none if the memory state is not available, see
+ * att_memory_state(). */
+BOOTLOADER_SECTION uint8_t att_resp_batch(const uint8_t *reqs, uint8_t n, uint8_t *result_msgs, uint8_t *metadata) {
+  uint8_t sreg;
+  uint16_t ctr;
+  uint8_t memory_state[32];
+  uint8_t ok;
+  sreg = SREG;
+  cli();
 
-  // Finalize
-  hmac_sha256_final(mac, &ctx); 
+  for(uint16_t i = 0; i < HASH_MAP_SIZE; i++) {
+    metadata[i] = 0;
+  }
 
-  // SREG = sreg;
+  ok = att_memory_state(memory_state);
+  for(uint8_t i = 0; ok && i < n; i++) {
+    memcpy_boot(&ctr, reqs, 2);
+    att_resp_fill(result_msgs, ctr, reqs + 2, memory_state, ATT_RESP_MAC_OFFSET, 0x6666666666666666);
+    reqs += ATT_BATCH_REQ_SIZE;
+    result_msgs += ATT_RESP_SIZE;
+  }
 
+  SREG = sreg;
+  sei();
+  return ok;
 }
+#endif
+
+#ifdef ATT_SAMPLE
+/* Sampled memory state: MAC over k distinct pages picked by the nonce,
+ * followed by nonce, k and ATT_ORDER_SAMPLED. The pick order is byte d%32 of
+ * SHA-256(nonce || d/32) mod MEM_PAGES for draws d = 0, 1, ..., skipping
+ * pages already taken (d/32 as 16 bit little endian). */
+BOOTLOADER_SECTION static void att_sample_state(uint8_t *memory_state, const uint8_t *nonce, uint8_t k) {
+  mac_ctx_t ctx;
+  uint8_t seed[18];
+  uint8_t idx[SHA256_HASH_BYTES];
+  uint8_t taken[MEM_PAGES/8] = {0};
+  uint16_t draw = 0;
+  uint16_t offset;
+  uint8_t page;
+  uint8_t n = 0;
+
+  load_mac_ctx(&ctx);
+  memcpy_boot(seed, nonce, 16);
+
+  while(n < k) {
+    if((draw & 0x1F) == 0) {
+      seed[16] = (uint8_t) (draw >> 5);
+      seed[17] = (uint8_t) (draw >> 13);
+      sha256((sha256_hash_t*) idx, seed, sizeof(seed)*8);
+    }
+    page = idx[draw & 0x1F] % MEM_PAGES;
+    draw++;
+    if(taken[page >> 3] & (1 << (page & 0x07)))
+      continue;
+    taken[page >> 3] |= 1 << (page & 0x07);
+    n++;
+
+    offset = APP_START + (uint16_t) page * PAGE_SIZE;
+    mac_nextBlocks_P(&ctx, (const void*) offset, PAGE_SIZE/MAC_BLOCK_BYTES);
+  }
 
+  /* seed still starts with the nonce */
+  seed[16] = k;
+  seed[17] = ATT_ORDER_SAMPLED;
+  mac_lastBlock(&ctx, seed, sizeof(seed)*8);
+  memzero_boot(memory_state, 32);
+  mac_final(memory_state, &ctx);
+  memzero_boot(&ctx, sizeof(ctx));
+  stack_wipe_boot(MAC_STACK_BYTES);
+}
 
-BOOTLOADER_SECTION void att_resp(uint8_t *msg_buf, uint8_t *result_msg, uint8_t mem_changed, uint8_t *metadata, uint8_t *prev_mem_state) {
+/* att_sample request: like att_resp(), but memory_state only covers the k
+ * pages (msg_buf[40]) picked by the nonce. k is echoed at [74] and the MAC
+ * moves to [75:107]. Not cached, every request rescans its sample. */
+BOOTLOADER_SECTION void att_sample_resp(uint8_t *msg_buf, uint8_t *result_msg, uint8_t *metadata) {
   uint16_t ctr;
-  uint64_t nonce[2];
-  uint64_t att_resp_keyword = 0x6666666666666666;
-  uint16_t self_id = 1000;
-  uint8_t ver_mac[] = {0x02, 0x00, 0x00, 0x99, 0x99, 0x99};
+  uint8_t memory_state[32];
 
   for(uint16_t i = 0; i < HASH_MAP_SIZE; i++) {
     metadata[i] = 0;
   }
 
-  memcpy(&ctr, msg_buf + 22, 2);
-  memcpy(nonce, msg_buf + 24, 16);
+  memcpy_boot(&ctr, msg_buf + 22, 2);
+  att_sample_state(memory_state, msg_buf + 24, msg_buf[40]);
+
+  result_msg[74] = msg_buf[40];
+  att_resp_fill(result_msg, ctr, msg_buf + 24, memory_state, ATT_SAMPLE_MAC_OFFSET, 0x6666666666666666);
+}
+
+#endif
+#ifdef ATT_SELF
+/* Stores the verifier epoch (msg_buf[24:40]) used by att_self() in place of
+ * a nonce. Only taken with the verifier MAC over [14:40] at
+ * [ATT_EPOCH_MAC_OFFSET], and only if it differs from the stored one, to
+ * spare the EEPROM. Returns 0 if the epoch was refused. */
+BOOTLOADER_SECTION static uint8_t att_epoch(uint8_t *msg_buf) {
+  uint8_t mac[MAC_BYTES];
+  uint8_t epoch[16];
+  uint8_t ok;
+
+  mac_buf(mac, msg_buf + 14, ATT_EPOCH_MAC_OFFSET - 14);
+  ok = (memcmp_boot(mac, msg_buf + ATT_EPOCH_MAC_OFFSET, MAC_BYTES) == 0);
+  memzero_boot(mac, sizeof(mac));
+  if(!ok)
+    return 0;
+
+  ee_read_block(epoch, EE_ATT_EPOCH, 16);
+  if(memcmp_boot(epoch, msg_buf + 24, 16) == 0)
+    return 0;
+  ee_update_block(msg_buf + 24, EE_ATT_EPOCH, 16);
+  return 1;
+}
 
+/* Self-initiated attestation, no request needed. Bumps the EEPROM counter and
+ * MACs the memory state with it and the current epoch. Layout as att_resp
+ * with keyword 0x99.., the epoch in the nonce field, counter bits 0..15 at
+ * [16:18] and 16..31 at [74:76], MAC at [76:108]. The verifier accepts each
+ * counter once per prover, so responses can be made ahead of time and sent
+ * whenever. Returns 0 if no epoch was set yet, -1 if the memory state is not
+ * available (see att_memory_state()). */
+BOOTLOADER_SECTION int8_t att_self(uint8_t *result_msg) {
+  uint8_t sreg;
+  uint8_t epoch[16];
   uint8_t memory_state[32];
-  if(!mem_changed) {
-    memcpy(memory_state, prev_mem_state, 32);
-    goto att_skip;
+  uint32_t ctr;
+  uint8_t i;
+  int8_t ret = 0;
+  sreg = SREG;
+  cli();
+
+  ee_read_block(epoch, EE_ATT_EPOCH, 16);
+  for(i = 0; i < 16 && epoch[i] == 0xFF; i++)
+    ;
+  if(i == 16)
+    goto end;
+
+  /* Erased EEPROM reads 0xFFFFFFFF, count from 0 then. Bump before MACing,
+   * so a reset can skip a value but never reuse one. */
+  ret = -1;
+  if(!att_memory_state(memory_state))
+    goto end;
+
+  ee_read_block(&ctr, EE_ATT_COUNTER, 4);
+  if(ctr == 0xFFFFFFFF)
+    ctr = 0;
+  ctr++;
+  ee_update_block(&ctr, EE_ATT_COUNTER, 4);
+
+  memcpy_boot(result_msg + 74, ((uint8_t*) &ctr) + 2, 2);
+  att_resp_fill(result_msg, (uint16_t) ctr, epoch, memory_state, ATT_SELF_MAC_OFFSET, 0x9999999999999999);
+  ret = 1;
+
+end:
+  SREG = sreg;
+  sei();
+  return ret;
+}
+
+#endif
+#ifdef ATT_MEASURE
+/* Records one self-measurement at time (app supplied, e.g. Timer1 overflow
+ * count, must increase between calls): MAC over memory state, time and
+ * ATT_ORDER_HISTORY. Returns 0 if time did not increase, -1 if the memory
+ * state is not available (see att_memory_state()). */
+BOOTLOADER_SECTION int8_t att_measure(uint32_t time) {
+  uint8_t sreg;
+  uint8_t buff[32 + 4 + 1];
+  att_entry_t *entry;
+  int8_t ret = 0;
+  sreg = SREG;
+  cli();
+
+  if(att_history.magic != ATT_HISTORY_MAGIC) {
+    att_history.head = 0;
+    att_history.count = 0;
+    att_history.magic = ATT_HISTORY_MAGIC;
+  } else if(att_history.count) {
+    entry = &att_history.entry[(att_history.head + ATT_HISTORY - 1) % ATT_HISTORY];
+    if(time <= entry->time)
+      goto end;
   }
 
-  remote_attestation(memory_state);
+  ret = -1;
+  if(!att_memory_state(buff))
+    goto end;
+  memcpy_boot(buff + 32, &time, 4);
+  buff[36] = ATT_ORDER_HISTORY;
+
+  entry = &att_history.entry[att_history.head];
+  mac_buf(entry->mac, buff, sizeof(buff));
+  entry->time = time;
+
+  att_history.head = (att_history.head + 1) % ATT_HISTORY;
+  if(att_history.count < ATT_HISTORY)
+    att_history.count++;
+  ret = 1;
 
-att_skip:
-  memcpy(result_msg, ver_mac, 6);
-  memcpy(result_msg + 14, &self_id, 2);
-  memcpy(result_msg + 16, &ctr, 2);
-  memcpy(result_msg + 18, nonce, 16);
-  memcpy(result_msg + 34, &att_resp_keyword, 8);
-  memcpy(result_msg + 42, memory_state, 32);
+end:
+  SREG = sreg;
+  sei();
+  return ret;
+}
 
-  hmac_sha256_ctx_t ctx;
-  uint8_t buff[PAGE_SIZE];
-  uint32_t offset;
+/* att_collect request: returns the recorded measurements, oldest first.
+ * Header as att_resp with keyword 0xBB.., count at [42], count entries of
+ * time (4) + MAC (MAC_BYTES) from [43], the rest zero, MAC over
+ * [0:ATT_HISTORY_MAC_OFFSET] binds them to the nonce. */
+BOOTLOADER_SECTION void att_collect_resp(uint8_t *msg_buf, uint8_t *result_msg) {
+  uint16_t ctr;
+  uint8_t count = 0;
+  uint8_t idx;
+  uint8_t *p;
+
+  memcpy_boot(&ctr, msg_buf + 22, 2);
+  att_resp_header(result_msg, ctr, msg_buf + 24, 0xBBBBBBBBBBBBBBBB);
+
+  p = result_msg + 43;
+  memzero_boot(p, ATT_HISTORY*sizeof(att_entry_t));
+  if(att_history.magic == ATT_HISTORY_MAGIC) {
+    count = att_history.count;
+    idx = (att_history.head + ATT_HISTORY - count) % ATT_HISTORY;
+    for(uint8_t i = 0; i < count; i++) {
+      memcpy_boot(p, &att_history.entry[idx], sizeof(att_entry_t));
+      p += sizeof(att_entry_t);
+      idx = (idx + 1) % ATT_HISTORY;
+    }
+  }
+  result_msg[42] = count;
 
-  // Init hmac context with key (load 20 byte key temporary in buff)
-  load_key(buff,key_hmac);
- 
-  hmac_sha256_init(&ctx, buff, 256);
-  hmac_sha256_nextBlock(&ctx, result_msg);
-  hmac_sha256_lastBlock(&ctx, result_msg + SHA256_BLOCK_BYTES, 80);
-  hmac_sha256_final(result_msg + 74, &ctx); 
+  att_resp_mac(result_msg, ATT_HISTORY_MAC_OFFSET);
 }
 
+#endif
 BOOTLOADER_SECTION void status_update(uint8_t *msg_buf, uint8_t msg_length, uint8_t keyword, uint8_t *metadata) {
 
   if(keyword == 3) {
@@ -484,10 +1834,10 @@ BOOTLOADER_SECTION void status_update(uint8_t *msg_buf, uint8_t msg_length, uint
 
 }
 
-BOOTLOADER_SECTION int8_t parse_att_msg(const uint8_t *msg, uint8_t msg_length, uint8_t *result_msg, uint8_t mem_changed, uint8_t *metadata, uint8_t *prev_mem_state) {
-  // uint8_t sreg;
-  // sreg = SREG;
-  // cli();
+BOOTLOADER_SECTION int8_t parse_att_msg(const uint8_t *msg, uint8_t msg_length, uint8_t *result_msg, uint8_t *metadata) {
+  uint8_t sreg;
+  sreg = SREG;
+  cli();
 
   int8_t retval = 0;
 
@@ -495,10 +1845,23 @@ BOOTLOADER_SECTION int8_t parse_att_msg(const uint8_t *msg, uint8_t msg_length,
   uint64_t status_update_kwrd = 0x2222222222222222;
   uint64_t status_valid_kwrd = 0x3333333333333333;
   uint64_t status_final_kwrd = 0x4444444444444444;
+#ifdef ATT_SAMPLE
+  uint64_t att_sample_kwrd = 0x7777777777777777;
+#endif
+#ifdef ATT_SELF
+  uint64_t att_epoch_kwrd = 0x8888888888888888;
+#endif
+#ifdef ATT_MEASURE
+  uint64_t att_collect_kwrd = 0xAAAAAAAAAAAAAAAA;
+#endif
   static const uint8_t verif_mac[] = {0x02, 0x00, 0x00, 0x99, 0x99, 0x99};
 
   uint8_t msg_buf[100] = {0};
-  memcpy(msg_buf, msg, msg_length);
+  if(msg_length > sizeof(msg_buf)) {
+    retval = -3;
+    goto end;
+  }
+  memcpy_boot(msg_buf, msg, msg_length);
 
   for(uint8_t i = 6; i < 12; i++) {
     if (msg_buf[i] != verif_mac[i-6]) {
@@ -510,8 +1873,8 @@ BOOTLOADER_SECTION int8_t parse_att_msg(const uint8_t *msg, uint8_t msg_length,
   uint64_t *kwrd_ptr = (uint64_t*)(msg_buf + 14);
 
   if(*kwrd_ptr == att_req_kwrd) {
-    att_resp(msg_buf, result_msg, mem_changed, metadata, prev_mem_state);
-    retval = 1;
+    // -4: no memory state while an att_start() scan is in progress
+    retval = att_resp(msg_buf, result_msg, metadata) ? 1 : -4;
     goto end;
   } else if(*kwrd_ptr == status_update_kwrd){
     status_update(msg_buf, msg_length, 2, metadata);
@@ -525,17 +1888,227 @@ BOOTLOADER_SECTION int8_t parse_att_msg(const uint8_t *msg, uint8_t msg_length,
     status_update(msg_buf, msg_length, 4, metadata);
     retval = 4;
     goto end;
+#ifdef ATT_SAMPLE
+  } else if(*kwrd_ptr == att_sample_kwrd){
+    if(msg_buf[40] == 0 || msg_buf[40] > MEM_PAGES) {
+      retval = -3;
+      goto end;
+    }
+    att_sample_resp(msg_buf, result_msg, metadata);
+    retval = 5;
+    goto end;
+#endif
+#ifdef ATT_SELF
+  } else if(*kwrd_ptr == att_epoch_kwrd){
+    if(msg_length < ATT_EPOCH_MSG_SIZE) {
+      retval = -3;
+      goto end;
+    }
+    // -5: bad verifier MAC or epoch unchanged
+    retval = att_epoch(msg_buf) ? 6 : -5;
+    goto end;
+#endif
+#ifdef ATT_MEASURE
+  } else if(*kwrd_ptr == att_collect_kwrd){
+    att_collect_resp(msg_buf, result_msg);
+    retval = 7;
+    goto end;
+#endif
   } else {
     retval = -2;
     goto end;
   }
 
 end:
-  // SREG = sreg;
-  // sei();
+  SREG = sreg;
+  sei();
   return retval;
 }
 
+#ifdef OTA_BROADCAST
+/* 1 if the MAC in the metadata header at meta starts with tag */
+BOOTLOADER_SECTION static uint8_t ota_tag_is(uint16_t meta, const uint8_t *tag) {
+  uint16_t mac = meta_mac(meta);
+
+  for(uint8_t i = 0; i < OTA_TAG_BYTES; i++)
+    if(pgm_read_byte_near(mac + i) != tag[i])
+      return 0;
+  return 1;
+}
+
+/* Pages of the image tagged tag already in SHADOW, as load_progress(): 0 if
+ * its header is not */
+BOOTLOADER_SECTION static uint8_t ota_progress(const uint8_t *tag, uint8_t *pages) {
+  if(!ota_tag_is(SHADOW_META, tag)) {
+    memzero_boot(pages, LOAD_PROGRESS_SIZE);
+    return 0;
+  }
+  return load_progress_read(pages);
+}
+
+/* 1 if every page of the image in SHADOW is set in pages */
+BOOTLOADER_SECTION static uint8_t ota_complete(const uint8_t *pages) {
+  uint16_t n = image_pages(SHADOW_META);
+
+  if(n > LOAD_PROGRESS_SIZE*8)
+    return 0;
+  for(uint16_t i = 0; i < n; i++)
+    if(!(pages[i >> 3] & (1 << (i & 0x07))))
+      return 0;
+  return 1;
+}
+
+/* ota_chunk: collects the chunk in page_buf and writes the page once it is
+ * complete. Header first: image pages are ignored until the header with
+ * this tag is in SHADOW, and pages already there are not collected again.
+ * Nothing is taken once the image is installed, SHADOW may hold the
+ * previous one (SWAP_IMAGE). */
+BOOTLOADER_SECTION static int8_t ota_chunk(const uint8_t *msg_buf, uint8_t *page_buf) {
+  uint8_t pages[LOAD_PROGRESS_SIZE];
+  const uint8_t *tag = msg_buf + 22;
+  uint8_t page = msg_buf[26];
+  uint8_t chunk = msg_buf[27];
+  uint8_t have;
+  uint16_t offset;
+
+  if(ota_tag_is(APP_META, tag))
+    return 1;
+  have = ota_progress(tag, pages);
+  if(page == OTA_HEADER_PAGE) {
+    if(have)
+      return 1;
+  } else {
+    if(!have)
+      return 1;
+    if(page >= image_pages(SHADOW_META))
+      return -3;
+    if(pages[page >> 3] & (1 << (page & 0x07)))
+      return 1;
+  }
+
+  if(ota_rx.magic != OTA_RX_MAGIC || ota_rx.page != page
+      || memcmp_boot(ota_rx.tag, tag, OTA_TAG_BYTES)) {
+    /* The page in the buffer stays missing, the verifier sends it again */
+    memcpy_boot(ota_rx.tag, tag, OTA_TAG_BYTES);
+    ota_rx.page = page;
+    ota_rx.chunks = 0;
+    ota_rx.magic = OTA_RX_MAGIC;
+  }
+  memcpy_boot(page_buf + chunk * OTA_CHUNK_BYTES, msg_buf + 28, OTA_CHUNK_BYTES);
+  ota_rx.chunks |= 1 << chunk;
+  if(ota_rx.chunks != (1 << OTA_CHUNKS) - 1)
+    return 1;
+  ota_rx.magic = 0;
+
+  if(page == OTA_HEADER_PAGE) {
+    /* Only the header this session announces, of an image that fits */
+    offset = (3 + (page_buf[4] | page_buf[5] << 8)) << 1;
+    if(offset > PAGE_SIZE - MAC_BYTES || memcmp_boot(page_buf + offset, tag, OTA_TAG_BYTES)
+        || (page_buf[0] | page_buf[1] << 8) > METADATA_OFFSET)
+      return -3;
+    offset = SHADOW_META - SHADOW;
+  } else {
+    offset = (uint16_t) page * PAGE_SIZE;
+  }
+  /* Not the listed page: collected again from the next round */
+  if(!load_page_check(page_buf, offset))
+    return -3;
+  write_page(page_buf, ((uint32_t) SHADOW) + offset);
+  load_record(offset);
+
+  /* Complete once no page is missing */
+  return (ota_progress(tag, pages) && ota_complete(pages)) ? 3 : 2;
+}
+
+/* ota_status: what this prover misses of the image tagged at [40:44], see
+ * OTA_STATUS_RESP_SIZE. Not MACed: a forged answer can only cost a
+ * retransmission, the image MAC decides at activation. */
+BOOTLOADER_SECTION static void ota_status_resp(const uint8_t *msg_buf, uint8_t *result_msg) {
+  uint8_t pages[LOAD_PROGRESS_SIZE];
+  const uint8_t *tag = msg_buf + 40;
+  uint16_t ctr;
+  uint16_t i;
+
+  memcpy_boot(&ctr, msg_buf + 22, 2);
+  att_resp_header(result_msg, ctr, msg_buf + 24, 0xEEEEEEEEEEEEEEEE);
+  memcpy_boot(result_msg + 42, tag, OTA_TAG_BYTES);
+
+  if(ota_tag_is(APP_META, tag)) {
+    result_msg[46] = OTA_STATE_INSTALLED;
+    for(i = 0; i < sizeof(pages); i++)
+      pages[i] = 0xFF;
+  } else if(ota_progress(tag, pages)) {
+    result_msg[46] = OTA_STATE_RECEIVING;
+    /* Pages past the image are not missing */
+    for(i = image_pages(SHADOW_META); i < LOAD_PROGRESS_SIZE*8; i++)
+      pages[i >> 3] |= 1 << (i & 0x07);
+  } else {
+    result_msg[46] = OTA_STATE_NO_HEADER;
+  }
+  for(i = 0; i < LOAD_PROGRESS_SIZE; i++)
+    result_msg[47 + i] = ~pages[i];
+}
+
+/* Broadcast OTA messages, see OTA_CHUNK_MSG_SIZE. page_buf is a PAGE_SIZE
+ * buffer of the app that it passes with every ota_chunk until the page is
+ * written. Returns 1 for a chunk taken (or not needed), 2 once it completed
+ * a page, 3 once the whole image is in SHADOW: the app then calls
+ * verify_activate_image(). 4 when result_msg holds an ota_status response
+ * (OTA_STATUS_RESP_SIZE bytes). -1 not from the verifier, -2 unknown
+ * keyword, -3 malformed or a page that is not the listed one
+ * (load_page_list()). */
+BOOTLOADER_SECTION int8_t parse_ota_msg(const uint8_t *msg, uint8_t msg_length, uint8_t *result_msg, uint8_t *page_buf) {
+  uint8_t sreg;
+  sreg = SREG;
+  cli();
+
+  int8_t retval = 0;
+
+  uint64_t ota_chunk_kwrd = 0xCCCCCCCCCCCCCCCC;
+  uint64_t ota_status_kwrd = 0xDDDDDDDDDDDDDDDD;
+  static const uint8_t verif_mac[] = {0x02, 0x00, 0x00, 0x99, 0x99, 0x99};
+
+  uint8_t msg_buf[OTA_CHUNK_MSG_SIZE] = {0};
+  memcpy_boot(msg_buf, msg, msg_length < sizeof(msg_buf) ? msg_length : sizeof(msg_buf));
+
+  for(uint8_t i = 6; i < 12; i++) {
+    if (msg_buf[i] != verif_mac[i-6]) {
+        retval = -1;
+        goto end;
+    }
+  }
+
+  uint64_t *kwrd_ptr = (uint64_t*)(msg_buf + 14);
+
+  if(*kwrd_ptr == ota_chunk_kwrd) {
+    if(msg_length < OTA_CHUNK_MSG_SIZE || msg_buf[27] >= OTA_CHUNKS
+        || (msg_buf[26] >= METADATA_OFFSET/PAGE_SIZE && msg_buf[26] != OTA_HEADER_PAGE)) {
+      retval = -3;
+      goto end;
+    }
+    retval = ota_chunk(msg_buf, page_buf);
+    goto end;
+  } else if(*kwrd_ptr == ota_status_kwrd){
+    if(msg_length < OTA_STATUS_MSG_SIZE) {
+      retval = -3;
+      goto end;
+    }
+    ota_status_resp(msg_buf, result_msg);
+    retval = 4;
+    goto end;
+  } else {
+    retval = -2;
+    goto end;
+  }
+
+end:
+  SREG = sreg;
+  sei();
+  return retval;
+}
+
+#endif
+
 BOOTLOADER_SECTION uint16_t hash_mac_address(unsigned char* mac) {
     unsigned int hash = 0;
     for (int i = 0; i < 6; i++) {
@@ -562,8 +2135,8 @@ BOOTLOADER_SECTION int8_t device_auth(uint8_t *MAC, uint8_t *update_req_msg, uin
     goto end;
   } else {
     if(!(meta & 4)) {
-      memcpy(update_req_msg, verif_mac, 6);
-      memcpy(update_req_msg + 14, &update_req_kwrd, 8);
+      memcpy_boot(update_req_msg, verif_mac, 6);
+      memcpy_boot(update_req_msg + 14, &update_req_kwrd, 8);
       meta &= 4;
     }
   }
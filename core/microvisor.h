@@ -2,15 +2,174 @@
 #define MICROVISOR_H
 #include <stdint.h>
 #include "mem_layout.h"
+#include "mac.h"
 
 #define METADATA_OFFSET APP_META
 #define PAGE_SIZE 256
 #define HASH_MAP_SIZE 32
-void load_image(uint8_t *page_buf, uint16_t offset);
+
+/* Attestation digest tree (ATT_MERKLE). Flash is split in ATT_LEAVES leaves of
+ * ATT_LEAF_PAGES pages each. The microvisor caches one SHA-256 digest per leaf
+ * and the root over all leaves; write_page() marks the leaf it touches dirty.
+ * Smaller leaves mean less rehashing per dirty page but more RAM
+ * (32 bytes per leaf). */
+#define ATT_LEAF_PAGES 16
+#define MEM_PAGES ((MEM_END + 1UL) / PAGE_SIZE)
+#define ATT_LEAVES (MEM_PAGES / ATT_LEAF_PAGES)
+
+/* Erased-page elision (ATT_SKIP_ERASED). Pages outside the live regions (app
+ * image and staged image up to the size in their header, both metadata pages,
+ * microvisor) that read all 0xFF are not compressed. Instead, one bit per page
+ * is set in an erased map which is hashed after the pages, so every byte of
+ * flash is still bound into the digest. */
+#define ATT_ERASED_MAP_SIZE (MEM_PAGES/8)
+
+/* Full-flash attestation (remote_attestation(), att_start()) is the MAC over
+ * the plain SHA-256 digest of flash and the nonce, so only unkeyed state is
+ * kept while the pages are hashed.
+ * Boot-first order (ATT_BOOT_FIRST): the microvisor region
+ * (MICROVISOR..MEM_END) never changes, so it is hashed first and the SHA-256
+ * state after it is computed by the build (BOOT_MIDSTATE). Hashing then
+ * resumes at APP_START. The order version is MACed after the nonce. */
+#define ATT_ORDER_BOOT_FIRST 0x02
+
+/* Largest compressed page frame load_image_lz() takes: every byte a literal,
+ * plus one flag byte per 8 (core/scripts/lz_page.py) */
+#define LZ_FRAME_MAX (PAGE_SIZE + PAGE_SIZE/8)
+
+/* Receive ring of load_rx(), kept in .bootbss: filled at head by the app's
+ * UART receive interrupt and by the load functions while they program flash,
+ * emptied at tail by the app. One slot stays free. The microvisor only
+ * writes buf[head % LOAD_RX_SIZE], whatever the app left in head. */
+#define LOAD_RX_SIZE 128
+
+typedef struct {
+  uint8_t buf[LOAD_RX_SIZE];
+  volatile uint8_t head;
+  volatile uint8_t tail;
+} load_rx_ring_t;
+
+/* Resumable loads: the microvisor keeps one bit per SHADOW page in EEPROM
+ * (EE_LOAD_PAGES) for the image whose header was loaded last, keyed by its
+ * MAC (EE_LOAD_MAC). load_progress() hands the bits to the app after a reset
+ * or a dropped link, so only the missing pages need to be sent again. */
+#define LOAD_PROGRESS_SIZE ((METADATA_OFFSET/PAGE_SIZE + 7)/8)
+
+/* att_resp message size, and size of one (ctr, nonce) tuple taken by
+ * att_resp_batch(). The memory state field [42:74] is 32 bytes whatever the
+ * MAC engine, a shorter tag (MAC_SHA1) is zero padded there. Response MACs
+ * are MAC_BYTES long. */
+#define ATT_RESP_MAC_OFFSET 74
+#define ATT_RESP_SIZE (ATT_RESP_MAC_OFFSET + MAC_BYTES)
+#define ATT_BATCH_REQ_SIZE 18
+
+/* Sampled attestation (att_sample keyword 0x77..). The request carries k
+ * (1..MEM_PAGES) at [40] and the nonce picks k distinct pages, so the cost
+ * is k pages instead of all of flash. The response echoes k at [74] and its
+ * MAC starts at [75]. remote_attestation() remains the full check. */
+#define ATT_ORDER_SAMPLED 0x03
+#define ATT_SAMPLE_MAC_OFFSET 75
+#define ATT_SAMPLE_RESP_SIZE (ATT_SAMPLE_MAC_OFFSET + MAC_BYTES)
+
+/* Self-initiated attestation (att_self()). The verifier broadcasts an epoch
+ * once (att_epoch keyword 0x88.., epoch at [24:40], its MAC over [14:40] from
+ * [40]), after which provers MAC their memory state with the epoch and a 32
+ * bit EEPROM counter, without a nonce round trip. A new epoch must differ
+ * from the stored one. Response keyword is 0x99.., counter high half at
+ * [74:76], MAC from [76]. */
+#define ATT_EPOCH_MAC_OFFSET 40
+#define ATT_EPOCH_MSG_SIZE (ATT_EPOCH_MAC_OFFSET + MAC_BYTES)
+#define ATT_SELF_MAC_OFFSET 76
+#define ATT_SELF_RESP_SIZE (ATT_SELF_MAC_OFFSET + MAC_BYTES)
+
+/* Self-measurement history (att_measure()). The app calls att_measure() from
+ * its main loop on a timer tick; the microvisor keeps the last ATT_HISTORY
+ * (time, MAC) entries. The verifier fetches them with att_collect (keyword
+ * 0xAA.., ctr and nonce as att_req), the response has keyword 0xBB.., count
+ * at [42], entries of time (4) + MAC from [43] and its MAC at
+ * [ATT_HISTORY_MAC_OFFSET:ATT_HISTORY_RESP_SIZE]. */
+#define ATT_HISTORY 4
+#define ATT_ORDER_HISTORY 0x04
+#define ATT_HISTORY_ENTRY_SIZE (4 + MAC_BYTES)
+#define ATT_HISTORY_MAC_OFFSET (43 + ATT_HISTORY*ATT_HISTORY_ENTRY_SIZE)
+#define ATT_HISTORY_RESP_SIZE (ATT_HISTORY_MAC_OFFSET + MAC_BYTES)
+
+#if MAC_BYTES > EE_LOAD_PAGES - EE_LOAD_MAC
+#error "EE_LOAD_MAC too small for the MAC!"
+#endif
+
+/* Page lists (load_page_list(), core/scripts/ota_pages.py): the first
+ * PAGE_HASH_BYTES of SHA-256(page || offset, 2 bytes little endian) for every
+ * image page, followed by the MAC over the header MAC and the list. Kept in
+ * EEPROM (EE_PAGE_LIST); once its MAC checked out, the load functions refuse
+ * a page that is not the listed one before it is written, in any order. */
+#define PAGE_HASH_BYTES 8
+#define PAGE_LIST_SIZE (METADATA_OFFSET/PAGE_SIZE*PAGE_HASH_BYTES)
+
+#if EE_PAGE_LIST < EE_LOAD_PAGES + LOAD_PROGRESS_SIZE || EE_PAGE_LIST + PAGE_LIST_SIZE > EE_END + 1
+#error "EE_PAGE_LIST does not fit!"
+#endif
+/* Broadcast OTA (parse_ota_msg()), message layout as parse_att_msg(). The
+ * verifier sends the image once to the whole swarm as ota_chunk messages
+ * (keyword 0xCC..): image tag (first OTA_TAG_BYTES of the image MAC) at
+ * [22:26], page at [26] (OTA_HEADER_PAGE for the metadata header), chunk at
+ * [27] and its OTA_CHUNK_BYTES at [28:92]. ota_status (keyword 0xDD.., ctr
+ * and nonce as att_req, tag at [40:44]) asks every prover what it misses;
+ * the response has keyword 0xEE.., tag at [42:46], OTA_STATE_* at [46] and a
+ * NACK bitmap at [47:54], bit i (LSB first) set for a missing page i. The
+ * verifier ORs the bitmaps and sends only those pages again. */
+#define OTA_TAG_BYTES 4
+#define OTA_CHUNK_BYTES 64
+#define OTA_CHUNKS (PAGE_SIZE/OTA_CHUNK_BYTES)
+#define OTA_HEADER_PAGE 0xFF
+#define OTA_CHUNK_MSG_SIZE (28 + OTA_CHUNK_BYTES)
+#define OTA_STATUS_MSG_SIZE (40 + OTA_TAG_BYTES)
+#define OTA_STATUS_RESP_SIZE (47 + LOAD_PROGRESS_SIZE)
+#define OTA_STATE_RECEIVING 0
+#define OTA_STATE_NO_HEADER 1
+#define OTA_STATE_INSTALLED 2
+
+#if ATT_LEAF_PAGES % 8
+#error "ATT_LEAF_PAGES must be a multiple of 8!"
+#endif
+#if ATT_LEAVES % 2
+#error "ATT_LEAVES must be even (two leaf digests per SHA-256 block)!"
+#endif
+#if ATT_HISTORY_RESP_SIZE > 255
+#error "ATT_HISTORY too large for one message!"
+#endif
+#if PAGE_SIZE % MAC_BLOCK_BYTES
+#error "MAC block size must divide PAGE_SIZE!"
+#endif
+#if defined ATT_BOOT_FIRST && !defined MAC_SHA256
+#error "ATT_BOOT_FIRST needs MAC_SHA256 (midstate patched by hex_patch_bootmem.py)!"
+#endif
+/* Peak stack use per entrypoint depends on the build (SHA-256 core, MAC
+ * engine, features): "make stack" in an app prints it with the deepest call
+ * path, from the -fstack-usage frames and the call graph of the linked ELF
+ * (core/scripts/stack_usage.py). The app has to leave that much SRAM free
+ * below its own deepest frame. No table for the default build is kept here
+ * yet: it has to be generated with avr-gcc ("make stack" in apps/hello_world)
+ * and added with its build options. */
+void copy_data(uint8_t *dest, uint16_t src, uint16_t length);
+uint8_t load_image(uint8_t *page_buf, uint16_t offset);
+uint8_t load_image_copy(uint16_t offset, const uint8_t *mac);
+uint8_t load_image_lz(const uint8_t *frame, uint16_t length, uint16_t offset);
+uint8_t load_page_list(const uint8_t *part, uint16_t offset, uint16_t length);
+load_rx_ring_t *load_rx(uint8_t attach);
+uint8_t load_progress(const uint8_t *mac, uint8_t *pages);
 uint8_t verify_activate_image();
 void remote_attestation(uint8_t *mac);
-int8_t parse_att_msg(const uint8_t *msg, uint8_t msg_length, uint8_t *result_msg, uint8_t mem_changed, uint8_t *metadata, uint8_t *prev_mem_state);
+void att_start(const uint8_t *nonce);
+uint8_t att_step(uint8_t blocks);
+uint8_t att_finish(uint8_t *mac);
+uint8_t att_resp_batch(const uint8_t *reqs, uint8_t n, uint8_t *result_msgs, uint8_t *metadata);
+int8_t parse_att_msg(const uint8_t *msg, uint8_t msg_length, uint8_t *result_msg, uint8_t *metadata);
+int8_t parse_ota_msg(const uint8_t *msg, uint8_t msg_length, uint8_t *result_msg, uint8_t *page_buf);
 int8_t device_auth(uint8_t *MAC, uint8_t *update_req_msg, uint8_t *metadata, uint16_t *prover_id_map);
 void map_init(uint16_t *map);
+void att_init();
+int8_t att_self(uint8_t *result_msg);
+int8_t att_measure(uint32_t time);
 
 #endif
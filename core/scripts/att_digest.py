@@ -0,0 +1,136 @@
+#!/usr/bin/env python3
+import sys, os, binascii, struct
+import hashlib
+sys.path += [ os.path.join(os.path.split(__file__)[0], 'libs') ]
+from intelhex import IntelHex
+import mac_engine
+
+PAGE_SIZE = 256
+MEM_SIZE = 32*1024
+
+# Must match ATT_LEAF_PAGES in core/microvisor.h
+leaf_pages = 16
+
+# Memory layout (byte addresses), see core/mem_layout.h
+#app_meta, shadow, shadow_meta, microvisor = 0x3D00, 0x3E00, 0x7B00, 0x7C00 # 1Kb bootloader
+#app_meta, shadow, shadow_meta, microvisor = 0x3B00, 0x3C00, 0x7700, 0x7800 # 2Kb bootloader
+app_meta, shadow, shadow_meta, microvisor = 0x3700, 0x3800, 0x6F00, 0x7000 # 4Kb bootloader
+
+# Mirrors att_page_erased() in core/microvisor.c (ATT_SKIP_ERASED)
+def page_erased(flash, offset):
+   if offset >= microvisor or offset in (app_meta, shadow_meta):
+      return False
+   if offset < app_meta:
+      base, header = 0, app_meta
+   else:
+      base, header = shadow, shadow_meta
+   end = struct.unpack("<H", flash[header:header+2])[0]
+   if end != 0xffff and offset - base < end:
+      return False
+   return flash[offset:offset+PAGE_SIZE] == b'\xff'*PAGE_SIZE
+
+# Mirrors att_hash_pages(): returns hashed bytes and the erased map
+def hash_pages(flash, offset, pages, skip_erased, map_size):
+   data = b''
+   erased = bytearray(map_size)
+   for i in range(pages):
+      page = offset + i*PAGE_SIZE
+      if skip_erased and page_erased(flash, page):
+         erased[i//8] |= 1 << (i%8)
+         continue
+      data += flash[page:page+PAGE_SIZE]
+   return data, bytes(erased)
+
+def tree_root(flash, skip_erased):
+   leaves = b''
+   for leaf in range(MEM_SIZE//(PAGE_SIZE*leaf_pages)):
+      data, erased = hash_pages(flash, leaf*PAGE_SIZE*leaf_pages, leaf_pages,
+            skip_erased, leaf_pages//8)
+      if skip_erased:
+         data += erased
+      leaves += hashlib.sha256(data).digest()
+   return hashlib.sha256(leaves).digest()
+
+# Response of remote_attestation() for a 20 byte nonce: MAC over the plain
+# SHA-256 memory digest and the nonce. With ATT_BOOT_FIRST the microvisor
+# region goes first into the digest, with the BOOT_MIDSTATE slot zeroed, and
+# the order version follows the nonce. The erased map closes the digest.
+def full_mac(flash, nonce, skip_erased, boot_first, mac):
+   pages = MEM_SIZE//PAGE_SIZE
+   if boot_first:
+      boot = flash[microvisor:MEM_SIZE-32] + bytes(32)
+      data, erased = hash_pages(flash, 0, microvisor//PAGE_SIZE, skip_erased, pages//8)
+      data = boot + data
+   else:
+      data, erased = hash_pages(flash, 0, pages, skip_erased, pages//8)
+   if skip_erased:
+      data += erased
+   data = hashlib.sha256(data).digest() + nonce
+   if boot_first:
+      data += b'\x02' # ATT_ORDER_BOOT_FIRST
+   return mac_engine.new(mac, data).digest()
+
+# Memory state of an att_sample response for a 16 byte nonce and k pages,
+# mirrors att_sample_state()
+def sample_state(flash, nonce, k, mac):
+   pages = MEM_SIZE//PAGE_SIZE
+   taken = set()
+   data = b''
+   draw = 0
+   while len(taken) < k:
+      if draw % 32 == 0:
+         idx = hashlib.sha256(nonce + struct.pack("<H", draw//32)).digest()
+      page = idx[draw % 32] % pages
+      draw += 1
+      if page in taken:
+         continue
+      taken.add(page)
+      data += flash[page*PAGE_SIZE:(page+1)*PAGE_SIZE]
+   data += nonce + bytes([k, 0x03]) # ATT_ORDER_SAMPLED
+   return mac_engine.new(mac, data).digest()
+
+def main(argv):
+   skip_erased = '--skip-erased' in argv
+   boot_first = '--boot-first' in argv
+   argv = [a for a in argv if a not in ('--skip-erased', '--boot-first')]
+   mac = mac_engine.parse_arg(argv)
+   sample = 0
+   if '--sample' in argv:
+      i = argv.index('--sample')
+      sample = int(argv[i+1])
+      del argv[i:i+2]
+   if len(argv) not in (1, 2) or (sample and len(argv) != 2):
+      print('att_digest.py [--skip-erased] [--boot-first] [--sample k] [--mac sha256|sha1|blake2s] <hexfile> [nonce]')
+      sys.exit(2)
+   if boot_first and mac != 'sha256':
+      print("ERROR: --boot-first needs --mac sha256")
+      sys.exit(2)
+
+   # Check if hexfile exists
+   hexfile = argv[0]
+   if not os.path.isfile(hexfile):
+      print("ERROR: File not found:", hexfile)
+      sys.exit(2)
+
+   # Unprogrammed flash reads as 0xFF, which is the IntelHex default padding
+   ih = IntelHex(hexfile)
+   flash = ih.tobinarray(0, MEM_SIZE-1).tobytes()
+
+   if skip_erased:
+      pages = MEM_SIZE//PAGE_SIZE
+      elided = sum(page_erased(flash, p*PAGE_SIZE) for p in range(pages))
+      print("Erased pages elided:", elided, "of", pages)
+
+   # Memory state as reported by att_resp with ATT_MERKLE
+   print("Tree root:")
+   print(binascii.hexlify(tree_root(flash, skip_erased)))
+
+   if sample:
+      print("Sampled memory state (k = %d):" % sample)
+      print(binascii.hexlify(sample_state(flash, binascii.unhexlify(argv[1]), sample, mac)))
+   elif len(argv) == 2:
+      print("Full scan response:")
+      print(binascii.hexlify(full_mac(flash, binascii.unhexlify(argv[1]), skip_erased, boot_first, mac)))
+
+if __name__ == "__main__":
+     main(sys.argv[1:])
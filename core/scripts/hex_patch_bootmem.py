@@ -0,0 +1,66 @@
+#!/usr/bin/env python3
+import sys, os
+sys.path += [ os.path.join(os.path.split(__file__)[0], 'libs') ]
+from intelhex import IntelHex
+import sha256_mid
+
+# Length of key_hmac in core/microvisor.c
+key_size = 32
+
+# Microvisor region and build-time midstate slot (byte addresses), see
+# core/mem_layout.h
+#microvisor = int("0x7C00", 16) # 1Kb bootloader
+#microvisor = int("0x7800", 16) # 2Kb bootloader
+microvisor = int("0x7000", 16) # 4Kb bootloader
+mem_end = int("0x8000", 16)
+boot_midstate = int("0x7FE0", 16)
+
+def main(argv):
+   if len(argv) not in (2, 3):
+      print('hex_patch_bootmem.py <ihexfile> <key_hmac> [<key_hmac_mid>]')
+      sys.exit(2)
+
+   # key_hmac_mid only exists with MAC_SHA256, other MAC engines key their
+   # context at runtime and need no patching
+   if len(argv) == 2:
+      print("No key_hmac_mid in image, nothing to patch")
+      return
+
+   # Check if hexfile exists
+   hexfile = argv[0]
+   if not os.path.isfile(hexfile):
+      print("ERROR: File not found:", hexfile)
+      sys.exit(2)
+
+   # Parse symbol addresses (byte addresses in .bootmem, from nm)
+   try:
+      key_addr = int(argv[1], 16)
+      mid_addr = int(argv[2], 16)
+   except:
+      print("ERROR: Addresses not valid:", argv[1], argv[2])
+      sys.exit(2)
+
+   # Start parsing ihex (byte addressed, unlike the metadata patcher)
+   ih = IntelHex(hexfile)
+
+   # Read the device key from the image itself, so it is defined only once
+   key = ih.tobinarray(key_addr, size=key_size).tobytes()
+
+   # HMAC inner/outer midstates, laid out as two sha256_ctx_t.h[] arrays
+   inner, outer = sha256_mid.hmac_midstates(key)
+   midstates = sha256_mid.state_bytes(inner) + sha256_mid.state_bytes(outer)
+   ih.frombytes(midstates, mid_addr)
+
+   # Plain SHA-256 state after the microvisor region (ATT_BOOT_FIRST), no key
+   # in it. Computed over the final region contents, with the slot itself
+   # still zero.
+   ih.frombytes(bytes(32), boot_midstate)
+   region = ih.tobinarray(microvisor, mem_end-1).tobytes()
+   boot = sha256_mid.midstate(region)
+   ih.frombytes(sha256_mid.state_bytes(boot), boot_midstate)
+
+   # Write out file
+   ih.write_hex_file(hexfile)
+
+if __name__ == "__main__":
+     main(sys.argv[1:])
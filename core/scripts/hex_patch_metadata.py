@@ -1,8 +1,8 @@
 #!/usr/bin/env python3
 import sys, os
-import hmac, hashlib
 sys.path += [ os.path.join(os.path.split(__file__)[0], 'libs') ]
 from intelhex import IntelHex16bit
+import mac_engine
 
 # Plain Unsafe ops (op = bytes = word {little endian})
 # ----------------------------------------------------
@@ -57,12 +57,10 @@ two_word_ops = [int("0x940C", 16), int("0x940E", 16)]
 #metadata_offset = int("0x3B00", 16)//2 # 2Kb bootloader
 metadata_offset = int("0x3700", 16)//2 # 4Kb bootloader
 
-# 160 bit key
-key = b'\x6e\x26\x88\x6e\x4e\x07\x07\xe1\xb3\x0f\x24\x16\x0e\x99\xb9\x12\xe4\x61\xc4\x24'
-
 def main(argv):
+   mac = mac_engine.parse_arg(argv)
    if len(argv) != 3:
-      print('hex_patch_metadata.py <ihexfile> <datastart> <dataend>')
+      print('hex_patch_metadata.py [--mac sha256|sha1|blake2s] <ihexfile> <datastart> <dataend>')
       sys.exit(2)
 
    # Check if hexfile exists
@@ -99,6 +97,11 @@ def main(argv):
                print(ih[addr])
                print(addr)
                unsafe_2ndword.append(addr)
+       elif ih[addr] in unsafe_ops or (ih[addr] & lpm_mask) in lpm_ops:
+           # Not rewritten (library code): verify_shadow() refuses the image,
+           # fine for an image that is only ever flashed with ISP
+           print("WARNING: unsafe op 0x%04x at 0x%04x, verify_activate_image() will refuse this image"
+                 % (ih[addr], addr*2))
 
    # Start patching hex
    ih[metadata_offset] = dataend # total .text + .data size
@@ -111,8 +114,8 @@ def main(argv):
    meta_size = 3 # base size
    meta_size += len(unsafe_2ndword)
 
-   # Calculate hmac
-   hmac_gen = hmac.new(key, None, hashlib.sha1)
+   # Calculate MAC with the engine of the build (verify_hmac())
+   hmac_gen = mac_engine.new(mac)
    hmac_gen.update(ih.tobinstr(0,dataend-1)) # tobinstr uses byteaddr, even on an IntelHex16 object
    hmac_gen.update(ih.tobinstr(metadata_offset*2, (metadata_offset + meta_size)*2 - 1))
    print(hmac_gen.hexdigest());
@@ -0,0 +1,107 @@
+# Page-wise LZ77 frames for compressed OTA images, decoded by lz_decode() in
+# core/microvisor.c. Every page is a frame of its own. Matches may reach back
+# into earlier pages of the image: those are already in SHADOW when the frame
+# arrives (pages are loaded in ascending order), so the decoder reads them
+# from flash and only needs the page buffer in SRAM.
+#
+# A frame is groups of a flag byte followed by up to 8 tokens, flag bit i
+# (LSB first) for token i: 0 is a literal byte, 1 a match of two bytes
+#   d & 0xFF, (d >> 8) << 4 | (length - 3)     with d = distance - 1
+# copying length (3..18) bytes from distance (1..4096) bytes back in the
+# image, possibly overlapping its own output. Matches end inside the page. A
+# frame of a short last page decodes to fewer than PAGE_SIZE bytes, the rest
+# of the page is 0xFF.
+import bisect
+
+PAGE_SIZE = 256
+MIN_MATCH = 3
+MAX_MATCH = 18
+MAX_DIST = 4096
+# Worst case, all literals
+FRAME_MAX = PAGE_SIZE + PAGE_SIZE//8
+
+# Positions of every MIN_MATCH byte string in data
+def index(data):
+   idx = {}
+   for p in range(len(data) - MIN_MATCH + 1):
+      idx.setdefault(data[p:p+MIN_MATCH], []).append(p)
+   return idx
+
+# Frame for the page of data at start (a multiple of PAGE_SIZE)
+def compress(data, start, idx=None):
+   if idx is None:
+      idx = index(data)
+   end = min(start + PAGE_SIZE, len(data))
+   tokens = []
+   pos = start
+   while pos < end:
+      best_len, best_dist = 0, 0
+      limit = min(MAX_MATCH, end - pos)
+      cand = idx.get(data[pos:pos+MIN_MATCH], [])
+      # Nearest candidates first, inside the window and before pos
+      i = bisect.bisect_left(cand, pos) - 1
+      while i >= 0 and pos - cand[i] <= MAX_DIST:
+         p = cand[i]
+         n = 0
+         while n < limit and data[p + n] == data[pos + n]:
+            n += 1
+         if n > best_len:
+            best_len, best_dist = n, pos - p
+            if n == limit:
+               break
+         i -= 1
+      if best_len >= MIN_MATCH:
+         d = best_dist - 1
+         tokens.append(bytes((d & 0xFF, (d >> 8) << 4 | (best_len - MIN_MATCH))))
+         pos += best_len
+      else:
+         tokens.append(data[pos:pos+1])
+         pos += 1
+   out = bytearray()
+   for i in range(0, len(tokens), 8):
+      group = tokens[i:i+8]
+      out.append(sum(1 << j for j, t in enumerate(group) if len(t) == 2))
+      for t in group:
+         out += t
+   return bytes(out)
+
+# Reference decoder, same checks as lz_decode(). prev is the image before
+# the page.
+def decompress(frame, prev):
+   page = bytearray()
+   i = 0
+   while i < len(frame):
+      flags = frame[i]
+      i += 1
+      for bit in range(8):
+         if i >= len(frame):
+            break
+         if flags & (1 << bit):
+            if len(frame) - i < 2:
+               raise ValueError('truncated match')
+            dist = (frame[i] | (frame[i+1] >> 4) << 8) + 1
+            n = (frame[i+1] & 0x0F) + MIN_MATCH
+            i += 2
+            if dist > len(prev) + len(page) or n > PAGE_SIZE - len(page):
+               raise ValueError('match out of image')
+            for _ in range(n):
+               page.append(page[-dist] if dist <= len(page) else prev[len(prev) + len(page) - dist])
+         else:
+            if len(page) == PAGE_SIZE:
+               raise ValueError('page overflow')
+            page.append(frame[i])
+            i += 1
+   return bytes(page)
+
+# Frames for the pages of data (all, or those in pages), each prefixed with
+# its length (2 bytes, little endian)
+def frames(data, pages=None):
+   idx = index(data)
+   out = bytearray()
+   for start in range(0, len(data), PAGE_SIZE):
+      if pages is not None and start//PAGE_SIZE not in pages:
+         continue
+      frame = compress(data, start, idx)
+      assert decompress(frame, data[:start]) == data[start:start+PAGE_SIZE]
+      out += len(frame).to_bytes(2, 'little') + frame
+   return bytes(out)
@@ -0,0 +1,37 @@
+# Host side of the microvisor MAC engine (core/crypto/mac.h). The engine is
+# picked per build with MAC in core/Makefile.include; scripts take the same
+# name (sha256, sha1, blake2s, any case) with --mac.
+import hmac, hashlib
+
+# 256 bit device key, see key_hmac in core/microvisor.c
+key = b'\x6e\x26\x88\x6e\x4e\x07\x07\xe1\xb3\x0f\x24\x16\x0e\x99\xb9\x12\xe4\x61\xc4\x24' + b'\x01'*12
+
+engines = ('sha256', 'sha1', 'blake2s')
+
+# Tag length in bytes (MAC_BYTES)
+def tag_bytes(name):
+   return {'sha256': 32, 'sha1': 20, 'blake2s': 32}[name.lower()]
+
+# Returns a MAC object with update()/digest()/hexdigest() for engine name
+def new(name, data=None, k=key):
+   name = name.lower()
+   if name == 'blake2s':
+      m = hashlib.blake2s(key=k, digest_size=32)
+      if data is not None:
+         m.update(data)
+      return m
+   if name not in engines:
+      raise ValueError("unknown MAC engine: " + name)
+   return hmac.new(k, data, getattr(hashlib, name))
+
+# Pops '--mac <name>' from argv, returns the engine name (default sha256)
+def parse_arg(argv):
+   if '--mac' not in argv:
+      return 'sha256'
+   i = argv.index('--mac')
+   name = argv[i+1].lower()
+   del argv[i:i+2]
+   if name not in engines:
+      print("ERROR: unknown MAC engine:", name)
+      raise SystemExit(2)
+   return name
@@ -0,0 +1,71 @@
+#!/usr/bin/env python3
+# Delta OTA image: only the pages that differ from the installed image.
+#
+#   metadata header       as in ota_image.py (sizes, 2nd words, MAC)
+#   base MAC              MAC from the installed image's header
+#   page bitmap           ceil(pages/8) bytes, bit i (LSB first) set if page
+#                         i is sent, pages = ceil(total/PAGE_SIZE)
+#   sent pages            PAGE_SIZE each, the last one up to total size,
+#                         or with --lz as LZ frames (lz_page.py)
+#
+# Pages that are not sent are copied from the running app into SHADOW by the
+# microvisor (load_image_copy()), which refuses to do so unless the base MAC
+# matches the installed header. The full image MAC is then checked as for a
+# full image, so a wrong base can only fail verification.
+import sys, os
+sys.path += [ os.path.join(os.path.split(__file__)[0], 'libs') ]
+import mac_engine, ota_image, lz_page
+
+PAGE_SIZE = ota_image.PAGE_SIZE
+
+# Returns (bitmap, pages sent)
+def page_diff(new, base):
+   pages = (len(new) + PAGE_SIZE - 1)//PAGE_SIZE
+   bitmap = bytearray((pages + 7)//8)
+   sent = 0
+   for i in range(pages):
+      chunk = new[i*PAGE_SIZE:(i+1)*PAGE_SIZE]
+      # Only bytes inside the installed image are known to be in flash
+      if i*PAGE_SIZE + len(chunk) <= len(base) and base[i*PAGE_SIZE:i*PAGE_SIZE+len(chunk)] == chunk:
+         continue
+      bitmap[i >> 3] |= 1 << (i & 0x07)
+      sent += 1
+   return bytes(bitmap), sent
+
+def main(argv):
+   lz = '--lz' in argv
+   argv = [a for a in argv if a != '--lz']
+   mac = mac_engine.parse_arg(argv)
+   if len(argv) != 3:
+      print('ota_delta.py [--lz] [--mac sha256|sha1|blake2s] <new ihexfile> <installed ihexfile> <deltafile>')
+      sys.exit(2)
+
+   for hexfile in argv[:2]:
+      if not os.path.isfile(hexfile):
+         print("ERROR: File not found:", hexfile)
+         sys.exit(2)
+
+   ih = ota_image.load(argv[0])
+   base_ih = ota_image.load(argv[1])
+   new = ota_image.image(ih)
+   base = ota_image.image(base_ih)
+
+   bitmap, sent = page_diff(new, base)
+   pages = (len(new) + PAGE_SIZE - 1)//PAGE_SIZE
+
+   f = open(argv[2], 'wb')
+   f.write(ota_image.header(ih, mac))
+   f.write(ota_image.image_mac(base_ih, mac))
+   f.write(bitmap)
+   sent_pages = [i for i in range(pages) if bitmap[i >> 3] & (1 << (i & 0x07))]
+   if lz:
+      f.write(lz_page.frames(new, sent_pages))
+   else:
+      for i in sent_pages:
+         f.write(new[i*PAGE_SIZE:(i+1)*PAGE_SIZE])
+   f.close()
+
+   print(sent, 'of', pages, 'pages sent')
+
+if __name__ == "__main__":
+     main(sys.argv[1:])
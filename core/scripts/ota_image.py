@@ -2,6 +2,7 @@
 import sys, os, struct
 sys.path += [ os.path.join(os.path.split(__file__)[0], 'libs') ]
 from intelhex import IntelHex16bit
+import mac_engine, lz_page
 
 # Last page of app is reserved for metadata. One page is 256 bytes.
 # !! Caution !! This is a word address (16bit) and is used with IntelHex16bit
@@ -10,9 +11,39 @@ from intelhex import IntelHex16bit
 #metadata_offset = int("0x3B00", 16)//2 # 2Kb bootloader
 metadata_offset = int("0x3700", 16)//2 # 4Kb bootloader
 
+PAGE_SIZE = 256
+
+# Byte padding for gaps: tobinstr() pads per byte, even on an IntelHex16 object
+def load(hexfile):
+   ih = IntelHex16bit(hexfile)
+   ih.padding = 0xFF
+   return ih
+
+# Metadata header as load_image() takes it: sizes, unsafe 2nd words and MAC
+def header(ih, mac):
+   # Calculate word size of metadata section
+   meta_size = 3 # base size
+   meta_size += ih[metadata_offset+2] # len(unsafe_2ndword)
+   size = meta_size*2 + mac_engine.tag_bytes(mac)
+   return ih.tobinstr(metadata_offset*2, metadata_offset*2 + size - 1)
+
+# MAC in the metadata header, identifies an installed image
+def image_mac(ih, mac):
+   return header(ih, mac)[-mac_engine.tag_bytes(mac):]
+
+# .text + .data (tobinstr uses byteaddr, even on an IntelHex16 object)
+def image(ih):
+   # Get data end == total .text + .data size
+   dataend = ih[metadata_offset]
+   return ih.tobinstr(0, dataend-1)
+
 def main(argv):
+   # Pages as LZ frames for load_image_lz(), see lz_page.py
+   lz = '--lz' in argv
+   argv = [a for a in argv if a != '--lz']
+   mac = mac_engine.parse_arg(argv)
    if len(argv) != 2:
-      print('ota_image.py <ihexfile> <binfile>')
+      print('ota_image.py [--lz] [--mac sha256|sha1|blake2s] <ihexfile> <binfile>')
       sys.exit(2)
 
    # Check if hexfile exists
@@ -25,24 +56,12 @@ def main(argv):
    binfile = argv[1]
 
    # Start parsing ihex
-   ih = IntelHex16bit(hexfile)
-
-   # Get data end == total .text + .data size
-   dataend = ih[metadata_offset]
-
-   # Calculate word size of metadata section
-   meta_size = 3 # base size
-   meta_size += ih[metadata_offset+2] # len(unsafe_2ndword)
-   meta_size += 10 # HMAC
+   ih = load(hexfile)
 
-   # Start filling file
+   # Metadata first, .text + .data after
    f = open(binfile, 'wb')
-
-   # First write metadata to beginning of file (!!Word addresses!!)
-   ih.tobinfile(f, metadata_offset*2, (metadata_offset + meta_size)*2 - 1)
-   # Write .text + .data after
-   ih.tobinfile(f, 0, dataend-1)
-
+   f.write(header(ih, mac))
+   f.write(lz_page.frames(image(ih)) if lz else image(ih))
    f.close()
 
 if __name__ == "__main__":
@@ -0,0 +1,54 @@
+#!/usr/bin/env python3
+# OTA image with a page list, so the microvisor rejects a bad page as soon as
+# it arrives instead of at activation (load_page_list()):
+#
+#   metadata header       as in ota_image.py (sizes, 2nd words, MAC)
+#   page list             PAGE_HASH_BYTES per page, pages = ceil(total/
+#                         PAGE_SIZE): the first bytes of SHA-256 over the page
+#                         (0xFF padded) and its offset, 2 bytes little endian
+#   list MAC              MAC over the header MAC and the page list
+#   pages                 PAGE_SIZE each, the last one up to total size
+#
+# The list MAC binds the list to this image; the image MAC is still checked
+# over the whole image at activation. Pages may be loaded in any order.
+import sys, os, struct, hashlib
+sys.path += [ os.path.join(os.path.split(__file__)[0], 'libs') ]
+import mac_engine, ota_image
+
+PAGE_SIZE = ota_image.PAGE_SIZE
+# PAGE_HASH_BYTES in core/microvisor.h
+PAGE_HASH_BYTES = 8
+
+# Listed hash of the page at offset
+def page_hash(page, offset):
+   page = page + b'\xff'*(PAGE_SIZE - len(page))
+   return hashlib.sha256(page + struct.pack("<H", offset)).digest()[:PAGE_HASH_BYTES]
+
+# Page list of data followed by its MAC, for the header MAC image_mac
+def page_list(data, image_mac, mac):
+   hashes = b''.join(page_hash(data[i:i+PAGE_SIZE], i) for i in range(0, len(data), PAGE_SIZE))
+   return hashes + mac_engine.new(mac, image_mac + hashes).digest()
+
+def main(argv):
+   mac = mac_engine.parse_arg(argv)
+   if len(argv) != 2:
+      print('ota_pages.py [--mac sha256|sha1|blake2s] <ihexfile> <pagesfile>')
+      sys.exit(2)
+
+   # Check if hexfile exists
+   hexfile = argv[0]
+   if not os.path.isfile(hexfile):
+      print("ERROR: File not found:", hexfile)
+      sys.exit(2)
+
+   ih = ota_image.load(hexfile)
+   data = ota_image.image(ih)
+
+   f = open(argv[1], 'wb')
+   f.write(ota_image.header(ih, mac))
+   f.write(page_list(data, ota_image.image_mac(ih, mac), mac))
+   f.write(data)
+   f.close()
+
+if __name__ == "__main__":
+     main(sys.argv[1:])
@@ -0,0 +1,194 @@
+#!/usr/bin/env python3
+# Worst case stack use of every microvisor entrypoint, from the build:
+#
+#   stack_usage.py [--objdump <path>] <elffile> <objectdir> [<function> ..]
+#
+# Frames of C functions come from the -fstack-usage files (<objectdir>/*.su,
+# see core/Makefile.include). Functions without one (assembly, avr-libc) get
+# their pushes plus the SP decrements (in/subi/sbci/out or sbiw on the SP
+# copy) counted from the disassembly, as an upper bound. The call graph is
+# the call/rcall/jmp/rjmp targets in avr-objdump -d; a call adds the 2 byte
+# return address, a jump to another function counts as a tail call. ijmp and
+# a jump to 0 leave for the app (virt_i.S, activation), icall is not
+# followed. Peak is on top of the caller's frame, interrupts not included:
+# the entrypoints run with interrupts off. For functions given after
+# objectdir the stack a call to them takes is printed as well, return address
+# included (e.g. the MAC engine for MAC_STACK_BYTES in microvisor.c).
+#
+# Exits 1 if a function could not be sized (indirect call, recursion, SP
+# moved by other means); those lines are marked with '?'.
+import sys, os, re, glob, subprocess
+
+RET_ADDR = 2
+SPL, SPH = 0x3d, 0x3e
+
+# microvisor.c lists the entrypoints in uvisor_entrypoints[]
+MICROVISOR_C = os.path.join(os.path.split(__file__)[0], '..', 'microvisor.c')
+
+func_line = re.compile(r'^([0-9a-f]+) <([^>]+)>:$')
+insn_line = re.compile(r'^\s*[0-9a-f]+:\s+(?:[0-9a-f]{2} )+\s*(\w+)\s*([^;]*)(?:;\s*(.*))?$')
+target = re.compile(r'0x([0-9a-f]+) <([^>+]+)>$')
+
+def entrypoints():
+   names = []
+   in_table = False
+   for line in open(MICROVISOR_C):
+      if 'uvisor_entrypoints[]' in line:
+         in_table = True
+      elif in_table:
+         m = re.search(r'\(uint16_t\) &(\w+),', line)
+         if m:
+            names.append(m.group(1))
+         elif '0x0000' in line:
+            break
+   return names
+
+# {function: bytes} from the .su files, largest of equal names
+def su_frames(objdir):
+   frames = {}
+   for su in glob.glob(os.path.join(objdir, '*.su')):
+      for line in open(su):
+         fields = line.rstrip('\n').split('\t')
+         if len(fields) < 3:
+            continue
+         name = fields[0].rsplit(':', 1)[-1]
+         # dynamic (alloca, VLA) frames have no fixed size
+         size = int(fields[1]) if fields[2] != 'dynamic' else None
+         if name in frames and (frames[name] is None or size is None):
+            frames[name] = None
+         else:
+            frames[name] = max(frames.get(name, 0), size)
+   return frames
+
+def imm(text):
+   text = text.strip()
+   return int(text, 16) if text.startswith('0x') else int(text)
+
+# {function: {'frame': bytes, 'calls': set, 'jumps': set, 'indirect': bool, ..}}
+def disassemble(objdump, elf):
+   out = subprocess.run([objdump, '-d', elf], stdout=subprocess.PIPE, check=True)
+   funcs = {}
+   f = None
+   for line in out.stdout.decode().splitlines():
+      m = func_line.match(line)
+      if m:
+         name = m.group(2)
+         f = funcs.setdefault(name, {'frame': 0, 'calls': set(), 'jumps': set(),
+                                     'indirect': False, 'sp': {}, 'sp_out': False})
+         continue
+      m = insn_line.match(line)
+      if not f or not m:
+         continue
+      op, args, comment = m.group(1), [a.strip() for a in m.group(2).split(',')], m.group(3) or ''
+      t = target.search(comment.strip())
+      if op in ('call', 'rcall', 'jmp', 'rjmp'):
+         # rcall .+0 only makes room on the stack, counted with push
+         if op == 'rcall' and args[0] == '.+0':
+            f['frame'] += RET_ADDR
+         elif t and op.endswith('call'):
+            f['calls'].add(t.group(2))
+         elif t and t.group(2) != name and int(t.group(1), 16):
+            f['jumps'].add(t.group(2))
+      elif op in ('icall', 'eicall'):
+         f['indirect'] = True
+      elif op == 'push':
+         f['frame'] += 1
+      elif op == 'in' and len(args) == 2 and imm(args[1]) in (SPL, SPH):
+         f['sp'][args[0]] = 0
+      elif op in ('subi', 'sbci') and args[0] in f['sp']:
+         f['sp'][args[0]] = imm(args[1]) & 0xFF
+      elif op == 'sbiw' and args[0] in f['sp']:
+         f['sp'][args[0]] = 0
+         f['sp'][args[0] + '+'] = imm(args[1])
+      elif op == 'out' and len(args) == 2 and imm(args[0]) == SPL:
+         f['sp_out'] = True
+         # SPL is written last: lo from subi, hi from sbci on the SPH copy
+         lo = f['sp'].get(args[1], 0)
+         hi = next((v for r, v in f['sp'].items() if r != args[1] and not r.endswith('+')), 0)
+         dec = (hi << 8 | lo) + f['sp'].pop(args[1] + '+', 0)
+         # A decrement above 32K is an increment: the frame is released
+         if 0 < dec < 0x8000:
+            f['frame'] += dec
+         f['sp'] = {}
+   return funcs
+
+class Graph:
+   def __init__(self, funcs, frames):
+      self.funcs = funcs
+      self.frames = frames
+      self.peaks = {}
+      self.unknown = set()
+
+   def frame(self, name):
+      if name in self.frames:
+         if self.frames[name] is None:
+            self.unknown.add(name)
+            return 0
+         return self.frames[name]
+      f = self.funcs[name]
+      if f['sp_out'] and not f['frame']:
+         self.unknown.add(name)
+      return f['frame']
+
+   # (bytes, path) of the deepest chain from name on, its own frame included
+   def peak(self, name, stack=()):
+      if name in self.peaks:
+         return self.peaks[name]
+      if name in stack or name not in self.funcs:
+         self.unknown.add(name)
+         return 0, [name + '?']
+      f = self.funcs[name]
+      if f['indirect']:
+         self.unknown.add(name)
+      below, path = 0, []
+      for c in f['calls']:
+         b, p = self.peak(c, stack + (name,))
+         if b + RET_ADDR > below:
+            below, path = b + RET_ADDR, p
+      for j in f['jumps']:
+         b, p = self.peak(j, stack + (name,))
+         if b > below:
+            below, path = b, p
+      self.peaks[name] = (self.frame(name) + below, [name] + path)
+      return self.peaks[name]
+
+def main(argv):
+   objdump = 'avr-objdump'
+   if '--objdump' in argv:
+      i = argv.index('--objdump')
+      objdump = argv[i+1] if i + 1 < len(argv) else ''
+      del argv[i:i+2]
+   if len(argv) < 2 or not objdump:
+      print('stack_usage.py [--objdump <path>] <elffile> <objectdir> [<function> ..]')
+      sys.exit(2)
+
+   elf, objdir = argv[0], argv[1]
+   for p in (elf, objdir):
+      if not os.path.exists(p):
+         print("ERROR: File not found:", p)
+         sys.exit(2)
+   frames = su_frames(objdir)
+   if not frames:
+      print("ERROR: no .su files in", objdir, "(build with -fstack-usage)")
+      sys.exit(2)
+
+   g = Graph(disassemble(objdump, elf), frames)
+   for name in entrypoints():
+      if name not in g.funcs:
+         continue
+      peak, path = g.peak(name)
+      mark = '?' if any(n in g.unknown for n in path) or path[-1].endswith('?') else ' '
+      print('%-24s %5d%s  %s' % (name, peak, mark, ' > '.join(path)))
+   for name in argv[2:]:
+      if name not in g.funcs:
+         print("ERROR: no function", name)
+         sys.exit(2)
+      peak, path = g.peak(name)
+      print('call %-19s %5d   %s' % (name, peak + RET_ADDR, ' > '.join(path)))
+
+   if g.unknown:
+      print('Not sized:', ' '.join(sorted(g.unknown)))
+      sys.exit(1)
+
+if __name__ == "__main__":
+   main(sys.argv[1:])